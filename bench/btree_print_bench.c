@@ -0,0 +1,507 @@
+/**
+ * @file btree_print_bench.c
+ * @brief btree_visual_print(函数版本)和BTREE_VISUAL_PRINT(纯宏版本)的性能测试
+ * @version 1.2
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * 编译 build:
+ *      cc -O2 -std=c99 -pthread -I.. btree_print_bench.c -o btree_print_bench
+ *
+ * 运行 run:
+ *      ./btree_print_bench                       # 全部形状, 1K到10M个结点, 输出CSV
+ *      ./btree_print_bench --sizes 1000,100000 --shapes balanced,random --impl func --repeat 5
+ *      ./btree_print_bench --seed 42 --out /dev/null
+ *      ./btree_print_bench --sizes 10000000 --shapes balanced,random --impl func --threads 1,2,4,8,16,32
+ *      ./btree_print_bench --check               # 不测性能, 只做检查, 有一项不过就返回1
+ *
+ * 每一组(实现, 形状, 结点数)在单独的子进程里跑, 这样peak_rss_kb就是这一组自己的内存峰值
+ * 随机数种子默认固定, 同样的参数每次生成同样的树, 可以拿来卡性能回退
+ *
+ * 三个阶段的耗时直接取自BTreePrintStats:
+ *      bfs_ns      层序遍历, 算深度, 格式化元素
+ *      inorder_ns  中序遍历算横坐标
+ *      emit_ns     逐行拼好并交给sink
+ * total_ns是整次调用的耗时, 重复多次时取total_ns最小的那一次
+ * 默认的sink什么都不写, 用--out FILE可以真的写到文件里
+ * --threads给出线程数列表时, 函数版本对每个线程数各跑一次btree_visual_print_parallel, 1就是单线程版本,
+ * 同一组的total_ns相除就是加速比; 宏版本没有多线程, threads一列总是1
+ *
+ * --check做下面几项检查, 可以放进CI:
+ *      known-good  一棵小树的打印结果和写死的结果一字不差, 函数版本和宏版本都查
+ *      scaling     同一个种子生成1K, 10K, 100K, 1M个结点的随机树, 排版(层序遍历加中序遍历)每个结点的耗时基本不变,
+ *                  最慢和最快差不到CHECK_SCALE_LIMIT倍; 按地址反查的O(n^2)做法在1M时会差上千倍
+ *      allocs      ctx.alloc_count: 新的ctx打印n个结点的树最多申请CHECK_ALLOC_PER_LOG * log2(n)次(缓冲区按两倍增长),
+ *                  同一个ctx再打印一棵同样大小的树一次都不申请; 每个结点calloc一次的做法会申请n次
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define BTREE_PRINT_PTHREAD
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btree_visual_print.h"
+#include "btree_visual_print_macro.h"
+
+enum
+{
+    SHAPE_BALANCED,
+    SHAPE_RANDOM,
+    SHAPE_LEFT,
+    SHAPE_RIGHT,
+    SHAPE_ZIGZAG,
+    SHAPE_WIDE,
+    SHAPE_NUM
+};
+
+static const char *shape_names[SHAPE_NUM] = {"balanced", "random", "left", "right", "zigzag", "wide"};
+
+/* wide形状的树形和balanced一样, 只是每个元素打印出来更长 */
+static const char *narrow_fmt = "%d";
+static const char *wide_fmt = "%d:wide-label-payload";
+
+typedef struct bench_opts
+{
+    unsigned long long seed;
+    long sizes[32];
+    int size_num;
+    int shapes[SHAPE_NUM];
+    int use_func, use_macro;
+    long max_chain; /* 退化成链的树每一行都很长, 输出是O(n^2)的, 超过这个结点数就跳过 */
+    int repeat;
+    const char *out_path;
+    int threads[32];
+    int thread_num;
+    int check;
+} BenchOpts;
+
+static unsigned long long rnd_state;
+
+static unsigned int rnd(void)
+{
+    rnd_state = rnd_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int)(rnd_state >> 33);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* 所有结点放在一个数组里, 按生成顺序分配 */
+static BTree gen_tree(int shape, long n, BTNode *pool)
+{
+    BTree root = NULL, prev = NULL;
+    long i;
+
+    for (i = 0; i < n; ++i)
+    {
+        pool[i].data = (char)(rnd() % 256 - 128);
+        pool[i].lchild = pool[i].rchild = NULL;
+    }
+    switch (shape)
+    {
+    case SHAPE_BALANCED:
+    case SHAPE_WIDE:
+        for (i = 1; i < n; ++i)
+        {
+            if (i & 1)
+                pool[(i - 1) / 2].lchild = &pool[i];
+            else
+                pool[(i - 1) / 2].rchild = &pool[i];
+        }
+        return n > 0 ? &pool[0] : NULL;
+    case SHAPE_RANDOM:
+    { /* 随机BST的形状: 每棵子树的根在子树结点中均匀随机取排名, 左右两边大小随之确定 */
+        typedef struct
+        {
+            BTree *slot;
+            long size;
+        } Task;
+        Task *stack = (Task *)malloc(sizeof(Task) * (size_t)(n + 2));
+        long top = -1, used = 0;
+        stack[++top].slot = &root;
+        stack[top].size = n;
+        while (top >= 0)
+        {
+            Task t = stack[top--];
+            long r;
+            if (t.size == 0)
+                continue;
+            *t.slot = &pool[used++];
+            r = (long)(rnd() % (unsigned long)t.size);
+            stack[++top].slot = &(*t.slot)->lchild;
+            stack[top].size = r;
+            stack[++top].slot = &(*t.slot)->rchild;
+            stack[top].size = t.size - 1 - r;
+        }
+        free(stack);
+        return root;
+    }
+    default: /* 三种链 */
+        for (i = 0; i < n; ++i)
+        {
+            if (prev == NULL)
+                root = &pool[i];
+            else if (shape == SHAPE_LEFT || (shape == SHAPE_ZIGZAG && (i & 1)))
+                prev->lchild = &pool[i];
+            else
+                prev->rchild = &pool[i];
+            prev = &pool[i];
+        }
+        return root;
+    }
+}
+
+/* 有--out的话写出去, 否则丢掉 */
+static int bench_sink(void *user, const char *buf, size_t len)
+{
+    return user != NULL ? btree_print_sink_file(user, buf, len) : 0;
+}
+
+static void run_one(const BenchOpts *opts, int use_macro, int threads, int shape, long n)
+{
+    BTNode *pool = (BTNode *)malloc(sizeof(BTNode) * (size_t)(n > 0 ? n : 1));
+    const char *fmt = shape == SHAPE_WIDE ? wide_fmt : narrow_fmt;
+    BTreePrintCtx ctx;
+    BTreePrintStats st, best;
+    FILE *fp = NULL;
+    uint64_t best_total = UINT64_MAX, t0;
+    struct rusage ru;
+    int r;
+
+    rnd_state = opts->seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)shape * 1000003ULL + (unsigned long long)n;
+    BTree root = gen_tree(shape, n, pool);
+    if (opts->out_path != NULL)
+        fp = fopen(opts->out_path, "w");
+    btree_print_ctx_init(&ctx);
+    memset(&best, 0, sizeof(best));
+
+    for (r = 0; r < opts->repeat; ++r)
+    {
+        t0 = now_ns();
+        if (use_macro)
+            BTREE_VISUAL_PRINT_STATS(&ctx, BTree, root, lchild, rchild, data, fmt, bench_sink, fp, &st);
+        else
+            btree_visual_print_parallel(&ctx, root, fmt, threads, bench_sink, fp, &st);
+        t0 = now_ns() - t0;
+        if (t0 < best_total)
+        {
+            best_total = t0;
+            best = st;
+        }
+    }
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    ru.ru_maxrss /= 1024; /* macOS上单位是字节 */
+#endif
+
+    printf("%s,%d,%s,%ld,%d,%d,%llu,%llu,%llu,%llu,%.0f,%lu,%.0f,%ld\n", use_macro ? "macro" : "func", threads, shape_names[shape], n,
+           best.max_depth, best.horizontal_accumu_cache, best.bfs_ns, best.inorder_ns, best.emit_ns, (unsigned long long)best_total,
+           best_total > 0 ? (double)n * 1e9 / (double)best_total : 0.0, (unsigned long)best.bytes_emitted,
+           best_total > 0 ? (double)best.bytes_emitted * 1e9 / (double)best_total : 0.0, (long)ru.ru_maxrss);
+
+    if (fp != NULL)
+        fclose(fp);
+    btree_print_ctx_free(&ctx);
+    free(pool);
+}
+
+/****************************************************************
+ * --check
+ ****************************************************************/
+
+/* 排版每个结点耗时最慢和最快的比值上限, 留够了缓存不命中的余量 */
+#define CHECK_SCALE_LIMIT 8.0
+
+/* 新ctx的申请次数上限是它乘log2(n): 结点表, 字符串池, 行缓冲区各自按两倍增长 */
+#define CHECK_ALLOC_PER_LOG 3
+
+/* btree_visual_print.h注释里的那棵树 */
+static const char check_expect[] = " _(5)___\n"
+                                   " |      |\n"
+                                   "(2)  _(10)__________\n"
+                                   "     |              |\n"
+                                   "    (5)       ____(20)\n"
+                                   "              |\n"
+                                   "           _(17)_\n"
+                                   "           |     |\n"
+                                   "         (12)  (19)\n";
+
+static int check_known_good(void)
+{
+    static const char data[8] = {5, 2, 10, 5, 20, 17, 12, 19};
+    BTNode n[8];
+    BTreePrintBuf buf = {0};
+    BTreePrintCtx ctx;
+    int i, fail = 0;
+
+    for (i = 0; i < 8; ++i)
+    {
+        n[i].data = data[i];
+        n[i].lchild = n[i].rchild = NULL;
+    }
+    n[0].lchild = &n[1];
+    n[0].rchild = &n[2];
+    n[2].lchild = &n[3];
+    n[2].rchild = &n[4];
+    n[4].lchild = &n[5];
+    n[5].lchild = &n[6];
+    n[5].rchild = &n[7];
+
+    btree_visual_print_sink(NULL, &n[0], "%d", btree_print_sink_buf, &buf);
+    if (buf.data == NULL || strcmp(buf.data, check_expect) != 0)
+        fail |= 1;
+    buf.len = 0;
+    btree_print_ctx_init(&ctx);
+    BTREE_VISUAL_PRINT_SINK(&ctx, BTree, &n[0], lchild, rchild, data, "%d", btree_print_sink_buf, &buf);
+    if (buf.data == NULL || strcmp(buf.data, check_expect) != 0)
+        fail |= 2;
+    btree_print_ctx_free(&ctx);
+    free(buf.data);
+    printf("check known-good func %s, macro %s\n", fail & 1 ? "FAIL" : "ok", fail & 2 ? "FAIL" : "ok");
+    return fail ? -1 : 0;
+}
+
+static int check_scaling(const BenchOpts *opts)
+{
+    static const long sizes[] = {1000, 10000, 100000, 1000000};
+    BTNode *pool = (BTNode *)malloc(sizeof(BTNode) * 1000000);
+    BTreePrintCtx ctx;
+    BTreePrintStats st;
+    int impl, z, r, repeat, fail = 0;
+
+    for (impl = 0; impl < 2; ++impl)
+    {
+        double per_node[4], lo = 1e300, hi = 0;
+        for (z = 0; z < 4; ++z)
+        {
+            long n = sizes[z];
+            uint64_t best = UINT64_MAX;
+            rnd_state = opts->seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)SHAPE_RANDOM * 1000003ULL;
+            BTree root = gen_tree(SHAPE_RANDOM, n, pool);
+            btree_print_ctx_init(&ctx);
+            repeat = (int)(1000000 / n) < 20 ? (int)(1000000 / n) : 20; /* 小树多跑几次取最快的 */
+            for (r = 0; r < (repeat > 0 ? repeat : 1); ++r)
+            {
+                if (impl)
+                    BTREE_VISUAL_PRINT_STATS(&ctx, BTree, root, lchild, rchild, data, narrow_fmt, bench_sink, NULL, &st);
+                else
+                    btree_visual_print_stats(&ctx, root, narrow_fmt, bench_sink, NULL, &st);
+                if (st.bfs_ns + st.inorder_ns < best)
+                    best = st.bfs_ns + st.inorder_ns;
+            }
+            btree_print_ctx_free(&ctx);
+            per_node[z] = (double)best / (double)n;
+            lo = per_node[z] < lo ? per_node[z] : lo;
+            hi = per_node[z] > hi ? per_node[z] : hi;
+        }
+        printf("check scaling %s layout ns/node: 1K %.1f, 10K %.1f, 100K %.1f, 1M %.1f, max/min %.2f %s\n", impl ? "macro" : "func",
+               per_node[0], per_node[1], per_node[2], per_node[3], hi / lo, hi / lo <= CHECK_SCALE_LIMIT ? "ok" : "FAIL");
+        if (hi / lo > CHECK_SCALE_LIMIT)
+            fail = 1;
+    }
+    free(pool);
+    return fail ? -1 : 0;
+}
+
+static int check_allocs(const BenchOpts *opts)
+{
+    static const long sizes[] = {1000, 1000000};
+    BTNode *pool = (BTNode *)malloc(sizeof(BTNode) * 1000000);
+    BTreePrintCtx ctx;
+    int impl, z, k, log2n, fail = 0;
+
+    for (impl = 0; impl < 2; ++impl)
+    {
+        for (z = 0; z < 2; ++z)
+        {
+            long n = sizes[z];
+            size_t fresh, reused = 0;
+            btree_print_ctx_init(&ctx);
+            for (k = 0; k < 2; ++k)
+            { /* 第二次换一个种子, 结点个数和形状一样, 元素不一样 */
+                rnd_state = (opts->seed + (unsigned long long)k) * 0x9E3779B97F4A7C15ULL;
+                BTree root = gen_tree(SHAPE_RANDOM, n, pool);
+                size_t before = ctx.alloc_count;
+                if (impl)
+                    BTREE_VISUAL_PRINT_SINK(&ctx, BTree, root, lchild, rchild, data, narrow_fmt, bench_sink, NULL);
+                else
+                    btree_visual_print_sink(&ctx, root, narrow_fmt, bench_sink, NULL);
+                if (k == 1)
+                    reused = ctx.alloc_count - before;
+            }
+            btree_print_ctx_free(&ctx);
+
+            btree_print_ctx_init(&ctx);
+            rnd_state = opts->seed * 0x9E3779B97F4A7C15ULL;
+            BTree root = gen_tree(SHAPE_RANDOM, n, pool);
+            if (impl)
+                BTREE_VISUAL_PRINT_SINK(&ctx, BTree, root, lchild, rchild, data, narrow_fmt, bench_sink, NULL);
+            else
+                btree_visual_print_sink(&ctx, root, narrow_fmt, bench_sink, NULL);
+            fresh = ctx.alloc_count;
+            btree_print_ctx_free(&ctx);
+
+            for (log2n = 0; (1L << log2n) < n; ++log2n)
+                ;
+            printf("check allocs %s n=%ld: fresh ctx %zu (limit %d), reused ctx %zu %s\n", impl ? "macro" : "func", n, fresh,
+                   CHECK_ALLOC_PER_LOG * log2n, reused, fresh <= (size_t)(CHECK_ALLOC_PER_LOG * log2n) && reused == 0 ? "ok" : "FAIL");
+            if (fresh > (size_t)(CHECK_ALLOC_PER_LOG * log2n) || reused != 0)
+                fail = 1;
+        }
+    }
+    free(pool);
+    return fail ? -1 : 0;
+}
+
+static int run_check(const BenchOpts *opts)
+{
+    int fail = 0;
+    fail |= check_known_good() < 0;
+    fail |= check_scaling(opts) < 0;
+    fail |= check_allocs(opts) < 0;
+    printf("check %s\n", fail ? "FAILED" : "passed");
+    return fail;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--seed N] [--sizes N,N,...] [--shapes balanced,random,left,right,zigzag,wide]\n"
+            "          [--impl func|macro|both] [--max-chain N] [--repeat N] [--out FILE] [--threads N,N,...]\n"
+            "       %s --check [--seed N]\n",
+            prog, prog);
+}
+
+static int parse_args(int argc, char **argv, BenchOpts *opts)
+{
+    static const long default_sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+    int i, k;
+    char *tok;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->seed = 1;
+    for (k = 0; k < 5; ++k)
+        opts->sizes[opts->size_num++] = default_sizes[k];
+    for (k = 0; k < SHAPE_NUM; ++k)
+        opts->shapes[k] = 1;
+    opts->use_func = opts->use_macro = 1;
+    opts->max_chain = 10000;
+    opts->repeat = 1;
+    opts->threads[opts->thread_num++] = 1;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--check") == 0)
+        {
+            opts->check = 1;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return -1;
+        if (strcmp(argv[i], "--seed") == 0)
+            opts->seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--sizes") == 0)
+        {
+            opts->size_num = 0;
+            for (tok = strtok(argv[++i], ","); tok != NULL && opts->size_num < 32; tok = strtok(NULL, ","))
+                opts->sizes[opts->size_num++] = strtol(tok, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--shapes") == 0)
+        {
+            memset(opts->shapes, 0, sizeof(opts->shapes));
+            for (tok = strtok(argv[++i], ","); tok != NULL; tok = strtok(NULL, ","))
+            {
+                for (k = 0; k < SHAPE_NUM && strcmp(tok, shape_names[k]) != 0; ++k)
+                    ;
+                if (k == SHAPE_NUM)
+                    return -1;
+                opts->shapes[k] = 1;
+            }
+        }
+        else if (strcmp(argv[i], "--impl") == 0)
+        {
+            ++i;
+            opts->use_func = strcmp(argv[i], "func") == 0 || strcmp(argv[i], "both") == 0;
+            opts->use_macro = strcmp(argv[i], "macro") == 0 || strcmp(argv[i], "both") == 0;
+        }
+        else if (strcmp(argv[i], "--max-chain") == 0)
+            opts->max_chain = strtol(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--repeat") == 0)
+            opts->repeat = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+        else if (strcmp(argv[i], "--out") == 0)
+            opts->out_path = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            opts->thread_num = 0;
+            for (tok = strtok(argv[++i], ","); tok != NULL && opts->thread_num < 32; tok = strtok(NULL, ","))
+                opts->threads[opts->thread_num++] = atoi(tok) > 0 ? atoi(tok) : 1;
+        }
+        else
+            return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOpts opts;
+    int impl, shape, z, t;
+
+    if (parse_args(argc, argv, &opts) < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opts.check)
+        return run_check(&opts);
+    printf("impl,threads,shape,nodes,depth,width,bfs_ns,inorder_ns,emit_ns,total_ns,nodes_per_s,bytes,bytes_per_s,peak_rss_kb\n");
+    for (shape = 0; shape < SHAPE_NUM; ++shape)
+    {
+        if (!opts.shapes[shape])
+            continue;
+        for (z = 0; z < opts.size_num; ++z)
+        {
+            long n = opts.sizes[z];
+            if ((shape == SHAPE_LEFT || shape == SHAPE_RIGHT || shape == SHAPE_ZIGZAG) && n > opts.max_chain)
+            {
+                fprintf(stderr, "skip %s n=%ld: output grows as n^2, raise --max-chain to run it\n", shape_names[shape], n);
+                continue;
+            }
+            for (impl = 0; impl < 2; ++impl)
+            {
+                if ((impl == 0 && !opts.use_func) || (impl == 1 && !opts.use_macro))
+                    continue;
+                for (t = 0; t < (impl == 0 ? opts.thread_num : 1); ++t)
+                {
+                    int threads = impl == 0 ? opts.threads[t] : 1;
+                    pid_t pid;
+                    fflush(stdout);
+                    pid = fork();
+                    if (pid == 0)
+                    {
+                        run_one(&opts, impl, threads, shape, n);
+                        fflush(stdout);
+                        _exit(0);
+                    }
+                    if (pid > 0)
+                        waitpid(pid, NULL, 0);
+                    else
+                        run_one(&opts, impl, threads, shape, n);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file btree_print_tpl_check.cpp
+ * @brief C++模板版本(btree_visual_print.hpp)的回归检查, 有一项不过就返回1
+ * @version 1.0
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * 编译 build:
+ *      c++ -O2 -std=c++17 -I.. btree_print_tpl_check.cpp -o btree_print_tpl_check
+ *
+ * 检查 checks:
+ *      fresh-ctx   用注释里的snprintf格式化函数在新的ctx上打印, 第一个元素一定走扩容再格式化的那条路,
+ *                  结果要和写死的一字不差, 不能混进'\0'
+ *      boundary    2000个结点, 每个元素正好4个字节, 总有一个元素碰上label_pool剩余空间正好等于长度,
+ *                  结果要和先格式化到临时缓冲区再拷贝的写法一字不差
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "btree_visual_print.hpp"
+
+struct Node
+{
+    int data;
+    Node *lchild, *rchild;
+};
+
+/* btree_visual_print.hpp注释里的格式化函数 */
+static int hex_snprintf(char *buf, size_t cap, int v)
+{
+    return snprintf(buf, cap, "%04x", v);
+}
+
+/* 参照: 先写进临时缓冲区, 再按约定拷贝 */
+static int hex_copy(char *buf, size_t cap, int v)
+{
+    char tmp[16];
+    int len = snprintf(tmp, sizeof(tmp), "%04x", v);
+    return _btree_print_copy_label(buf, cap, tmp, (size_t)len);
+}
+
+/* 数组里的完全二叉树, 下标i的孩子是2i+1和2i+2 */
+static std::vector<Node> make_tree(int n)
+{
+    std::vector<Node> nodes((size_t)n);
+    for (int i = 0; i < n; ++i)
+    {
+        nodes[i].data = i * 7 + 1;
+        nodes[i].lchild = 2 * i + 1 < n ? &nodes[2 * i + 1] : nullptr;
+        nodes[i].rchild = 2 * i + 2 < n ? &nodes[2 * i + 2] : nullptr;
+    }
+    return nodes;
+}
+
+template <class Format>
+static std::string print(const Node *root, const Format &format)
+{
+    BTreePrintCtx ctx;
+    std::string out;
+    btree_print_ctx_init(&ctx);
+    btree_visual_print(&ctx, root, btree_print_sink_string, &out, btree_print_default_access(), format);
+    btree_print_ctx_free(&ctx);
+    return out;
+}
+
+static int check(const char *name, bool ok)
+{
+    std::printf("check %s %s\n", name, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+int main()
+{
+    static const char expect[] = "   __(0001)__\n"
+                                 "   |         |\n"
+                                 "(0008)    (000f)\n";
+    int fail = 0;
+
+    std::vector<Node> small = make_tree(3);
+    std::string out = print(&small[0], hex_snprintf);
+    fail |= check("fresh-ctx", out == expect && out.find('\0') == std::string::npos);
+
+    std::vector<Node> big = make_tree(2000);
+    out = print(&big[0], hex_snprintf);
+    fail |= check("boundary", out == print(&big[0], hex_copy) && out.find('\0') == std::string::npos);
+
+    std::printf("check %s\n", fail ? "FAILED" : "passed");
+    return fail;
+}
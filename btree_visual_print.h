@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "btree_visual_print_core.h"
+
 /**
  * @brief 需要类似下方的结构体
  *
@@ -25,11 +27,31 @@ typedef struct node
 {
     // something else
     char data;                    //也可以是 int data, char *data, 等等
-                                  //但是如果用int *, char*, char**, struct A *, void* 这种再用指针另指元素, 下面函数有两行要修改, 已用TODO标出
+                                  //但是如果用int *, char*, char**, struct A *, void* 这种再用指针另指元素, 下面函数有一行要修改, 已用TODO标出
     struct node *lchild, *rchild; //如果用其他的名字, 下面函数中替换即可
 } BTNode, *BTree;                 //如果用其他的名字, 下面函数中替换即可
 #endif
 
+int btree_visual_print_ctx(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, FILE *fp);
+int btree_visual_print_sink(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, btree_print_sink_fn sink, void *user);
+int btree_visual_print_stats(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, btree_print_sink_fn sink, void *user,
+                             BTreePrintStats *stats);
+int btree_visual_print_summary(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, int max_depth, btree_print_sink_fn sink,
+                               void *user);
+int btree_visual_print_snapshot(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, btree_print_sink_fn sink, void *user);
+#if defined(__unix__) || defined(__APPLE__)
+int btree_visual_print_external(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, size_t mem_cap, const char *tmp_dir,
+                                btree_print_sink_fn sink, void *user);
+#endif
+#ifdef BTREE_PRINT_PTHREAD
+int btree_visual_print_parallel(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, int nthreads, btree_print_sink_fn sink,
+                                void *user, BTreePrintStats *stats);
+int btree_visual_print_async(BTreePrintAsync *async, const BTree root, const char *elem_fmt, int max_depth, btree_print_sink_fn sink,
+                             void *user);
+#endif
+int btree_layout_build(BTreeLayout *layout, const BTree root, const char *elem_fmt);
+int btree_layout_update(BTreeLayout *layout, const BTree root, const BTree changed);
+
 /**
  * @brief
  *
@@ -67,162 +89,465 @@ typedef struct node
  */
 void btree_visual_print(const BTree root, const char *elem_fmt, FILE *fp)
 {
-    if (root == NULL)
-        return;
-    const int _MAX_STR_LEN = 128;        //单个元素打印成str最大长度
-    const int _MAX_NODE_NUM = 1024;      //结点最大个数
-    const char horiz_conj_char = '_';    //连接横线
-    const char vert_conj_char = '|';     //竖线
-    const char left_bracket_char = '(';  //每个元素左边的小括号, 你也可以换成你喜欢的
-    const char right_bracket_char = ')'; //元素右边的小括号
-
-    //思路: 层序遍历算深度, 中序遍历算横坐标, 用结构体数组把这些信息存好再统一打印
-    typedef struct _node_print_info
+    BTreePrintCtx ctx;
+    btree_print_ctx_init(&ctx);
+    btree_visual_print_ctx(&ctx, root, elem_fmt, fp);
+    btree_print_ctx_free(&ctx);
+}
+
+/**
+ * @brief 同btree_visual_print, 但工作缓冲区由调用者提供, 反复打印时可以复用, 不用每次重新申请
+ *
+ * @param ctx 用btree_print_ctx_init初始化过的缓冲区
+ * @return 0成功, -1内存不足(此时什么都没打印)或写文件失败
+ */
+int btree_visual_print_ctx(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, FILE *fp)
+{
+    return btree_visual_print_sink(ctx, root, elem_fmt, btree_print_sink_file, fp);
+}
+
+/**
+ * @brief 同btree_visual_print_ctx, 但不经过FILE*, 每拼好一行就交给sink, 可以写到内存, std::string, fd等等
+ *
+ * @param ctx 用btree_print_ctx_init初始化过的缓冲区, 传NULL则临时申请一个
+ * @param sink 输出函数, 见btree_print_sink_file, btree_print_sink_buf, btree_print_sink_fd, btree_print_sink_string
+ * @param user 原样传给sink
+ * @return 0成功, -1内存不足或sink返回失败
+ * @example
+ *      BTreePrintBuf buf = {0};
+ *      btree_visual_print_sink(NULL, t, "%c", btree_print_sink_buf, &buf);
+ *      puts(buf.data);
+ *      free(buf.data);
+ */
+int btree_visual_print_sink(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, btree_print_sink_fn sink, void *user)
+{
+    return btree_visual_print_stats(ctx, root, elem_fmt, sink, user, NULL);
+}
+
+/**
+ * @brief 数一下root这棵子树有多少个结点, 用ctx->walk_stack当栈, 不递归
+ * @return 结点个数, -1内存不足
+ */
+static int _btree_visual_print_count(BTreePrintCtx *ctx, const BTree root)
+{
+    int top = 0, count = 0;
+    BTree p;
+    if (_btree_print_reserve_walk(ctx, 1) < 0)
+        return -1;
+    ctx->walk_stack[top++] = root;
+    while (top > 0)
     {
-        BTree address; //二次遍历时的唯一区分标志，即key //用hash表将地址映射会更省时间空间
-        int str_len;
-        int depth;
-        int left_margin; // horizontal coordintate
-    } _Info;
-
-    BTree tree_deque[_MAX_NODE_NUM];
-    int depth_queue[_MAX_NODE_NUM]; //记录深度的队列
-    _Info *info_p_arr[_MAX_NODE_NUM];
-    int node_count = 0;
-    int front = -1, rear = -1;
+        p = (BTree)ctx->walk_stack[--top];
+        count++;
+        if (_btree_print_reserve_walk(ctx, (size_t)top + 2) < 0)
+            return -1;
+        if (p->lchild != NULL)
+            ctx->walk_stack[top++] = p->lchild;
+        if (p->rchild != NULL)
+            ctx->walk_stack[top++] = p->rchild;
+    }
+    return count;
+}
+
+/**
+ * @brief 层序遍历, 把root这棵树的结点信息表和元素字符串填进ctx, 之后的事情就和结点类型无关了
+ * @param elem_fmt 传NULL时只建结构, 不格式化元素, 多线程打印时由各线程去格式化
+ * @param max_depth 大于0时, 第max_depth + 1层的结点不再展开, 整棵子树折叠成一个结点, 见BTREE_PRINT_COLLAPSED_FMT
+ * @return 0成功, -1内存不足
+ */
+static int _btree_visual_print_fill(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, int max_depth)
+{
+    //思路: 层序遍历算深度, 中序遍历算横坐标, 把这些信息存进ctx的结点信息表再统一打印
+    //所有数组都在ctx里按需增长, 结点个数和元素长度都没有上限
+    int front, child, count;
     BTree p;
-    _Info *info_p;
-    char temp_str[_MAX_STR_LEN];
+    _btree_print_reset(ctx);
+    if (root == NULL)
+        return 0;
 
-    //用队列统计结点的深度信息, 顺便统计每个结点数据打印时的长度
-    tree_deque[++rear] = root;
-    depth_queue[rear] = 1;
-    while (front < rear)
+    //用队列统计结点的深度信息, 顺便把每个结点的数据格式化进ctx->label_pool, 打印时直接拷贝, 不再格式化第二次
+    //ctx->address本身就是队列, 结点的下标就是它的层序序号, 孩子入队时顺手记下孩子的下标
+    if (_btree_print_push_info(ctx, root, 1) < 0)
+        return -1;
+    for (front = 0; front < ctx->node_count; ++front)
     {
-        p = tree_deque[++front];
-        info_p = (_Info *)calloc(1, sizeof(_Info));
-        info_p->address = p; //记录地址
-        memset(temp_str, 0, _MAX_STR_LEN);
-        sprintf(temp_str, elem_fmt, p->data);   // TODO: 注意
-        info_p->str_len = strlen(temp_str) + 2; //计算打印后的元素长度
-        info_p->depth = depth_queue[front];
-        info_p_arr[node_count++] = info_p;
+        p = (BTree)ctx->address[front];
+        if (max_depth > 0 && ctx->depth[front] > max_depth)
+        { //折叠结点只数个数, 不格式化, 孩子也不入队
+            if ((count = _btree_visual_print_count(ctx, p)) < 0 || _btree_print_put_collapsed(ctx, front, count) < 0)
+                return -1;
+            continue;
+        }
+        if (elem_fmt != NULL && _btree_print_put_label(ctx, front, elem_fmt, p->data) < 0) // TODO: 注意
+            return -1;
 
         if (p->lchild != NULL)
         {
-            tree_deque[++rear] = p->lchild;
-            depth_queue[rear] = depth_queue[front] + 1;
+            if ((child = _btree_print_push_info(ctx, p->lchild, ctx->depth[front] + 1)) < 0)
+                return -1;
+            ctx->lchild[front] = child;
         }
         if (p->rchild != NULL)
         {
-            tree_deque[++rear] = p->rchild;
-            depth_queue[rear] = depth_queue[front] + 1;
+            if ((child = _btree_print_push_info(ctx, p->rchild, ctx->depth[front] + 1)) < 0)
+                return -1;
+            ctx->rchild[front] = child;
         }
     }
+    return 0;
+}
 
-    //接下来统计横坐标, 用中序遍历
-    p = root;
-    int top = -1, i;
-    int horizontal_accumu_cache = 0; //横坐标累计长度
-    do
+/* 各个打印函数最终都走这里 */
+static int _btree_visual_print_run(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, int max_depth, btree_print_sink_fn sink,
+                                   void *user, BTreePrintStats *stats)
+{
+    if (ctx == NULL)
     {
-        while (p != NULL)
-        {
-            tree_deque[++top] = p;
-            p = p->lchild;
-        }
-        p = tree_deque[top--];
-        for (i = 0; i < node_count; ++i)
-        { //这里用hash表的优势就体现出来了
-            if (info_p_arr[i]->address == p)
-            { //计算横坐标
-                info_p_arr[i]->left_margin = horizontal_accumu_cache;
-                horizontal_accumu_cache += info_p_arr[i]->str_len - 1; //减一可以重叠一个括号,更紧凑一点点
-            }
-        }
-        p = p->rchild;
-    } while (!(p == NULL && top == -1));
-
-    //接下来开始打印
-    int horiz_left_start, horiz_right_end, cursor, j, k, cur_depth = 1, end_flag = 0;
-    int vert_index_arr[_MAX_NODE_NUM]; //偶数行的竖线存储数组
-    i = 0;
-    while (i < node_count)
+        BTreePrintCtx tmp_ctx;
+        int ret;
+        btree_print_ctx_init(&tmp_ctx);
+        ret = _btree_visual_print_run(&tmp_ctx, root, elem_fmt, max_depth, sink, user, stats);
+        btree_print_ctx_free(&tmp_ctx);
+        return ret;
+    }
+    if (stats != NULL)
+        _btree_print_stats_begin(ctx, stats);
+    if (_btree_visual_print_fill(ctx, root, elem_fmt, max_depth) < 0)
+        return -1;
+
+    //接下来中序遍历统计横坐标, 然后逐行打印, 这部分和结点类型无关, 见btree_visual_print_core.h
+    return _btree_print_render(ctx, sink, user, stats);
+}
+
+/**
+ * @brief 同btree_visual_print_sink, 另外把这次打印的统计信息写进stats: 结点数, 最大深度, 画布宽度,
+ *        输出字节数和行数, 内存申请次数, 以及层序遍历, 中序遍历, 逐行输出三个阶段各自的耗时(纳秒)
+ *        服务里打印卡住时, 可以看出时间是花在遍历, 排版还是I/O上
+ *
+ * @param stats 统计结果, 传NULL就等于btree_visual_print_sink
+ * @example
+ *      BTreePrintStats st;
+ *      btree_visual_print_stats(NULL, t, "%d", btree_print_sink_file, stdout, &st);
+ *      fprintf(stderr, "%d nodes, %zu bytes, emit %llu ns\n", st.node_count, st.bytes_emitted, st.emit_ns);
+ */
+int btree_visual_print_stats(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, btree_print_sink_fn sink, void *user,
+                             BTreePrintStats *stats)
+{
+    return _btree_visual_print_run(ctx, root, elem_fmt, 0, sink, user, stats);
+}
+
+/**
+ * @brief 摘要打印: 前max_depth层完整打印, 再往下的每棵子树折叠成一个结点, 显示子树的结点个数, 比如(...+4213)
+ *        折叠的子树只数结点个数, 不格式化, 不排版, 不输出, 所以输出大小和排版时间只取决于前max_depth层,
+ *        线上导出很大的树时不会一下子打出几个G
+ *
+ * @param ctx 同btree_visual_print_sink, 传NULL则临时申请一个
+ * @param max_depth 完整打印的层数, 根是第1层; 小于等于0时不折叠, 等于btree_visual_print_sink
+ * @example
+ *      btree_visual_print_summary(NULL, t, "%d", 2, btree_print_sink_file, stdout);
+ *
+ *           _________(85)_________
+ *           |                     |
+ *     ____(67)___           ____(119)____
+ *     |          |          |            |
+ * (...+155)  (...+842)  (...+797)   (...+2298)
+ */
+int btree_visual_print_summary(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, int max_depth, btree_print_sink_fn sink,
+                               void *user)
+{
+    return _btree_visual_print_run(ctx, root, elem_fmt, max_depth, sink, user, NULL);
+}
+
+/**
+ * @brief 不打印, 只把排版好的结果存成快照交给sink, 以后用btree_print_snapshot_open打开就能打印整棵树或者其中一块,
+ *        不用再遍历树, 也不用再排版; 格式见btree_visual_print_core.h里的btree_print_snapshot_write
+ *
+ * @param ctx 同btree_visual_print_sink, 传NULL则临时申请一个; ctx->layout决定用哪种排版
+ * @param sink 快照写到哪里, 比如btree_print_sink_file加一个用"wb"打开的文件
+ * @return 0成功, -1内存不足或sink返回失败
+ * @example
+ *      FILE *fp = fopen("tree.snap", "wb");
+ *      btree_visual_print_snapshot(NULL, t, "%d", btree_print_sink_file, fp);
+ *      fclose(fp);
+ *
+ *      BTreePrintSnapshot snap;
+ *      btree_print_snapshot_open(&snap, "tree.snap");
+ *      btree_print_snapshot_print_view(&snap, 0, 200, 1, 30, btree_print_sink_file, stdout);
+ *      btree_print_snapshot_close(&snap);
+ */
+int btree_visual_print_snapshot(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, btree_print_sink_fn sink, void *user)
+{
+    if (ctx == NULL)
     {
-        k = -1;
-        cursor = 0;
-        while (info_p_arr[i]->depth == cur_depth)
-        {
-            //打印左边
-            p = info_p_arr[i]->address;
-            if (p->lchild != NULL)
-            { //有左孩子说明有横线要打印
-                for (j = 0; j < node_count; ++j)
-                { //暴力查找
-                    if (info_p_arr[j]->address == p->lchild)
-                    {
-                        horiz_left_start = info_p_arr[j]->left_margin + info_p_arr[j]->str_len / 2;
-                        vert_index_arr[++k] = horiz_left_start;
-                        break;
-                    }
-                }
-                for (; cursor < horiz_left_start; ++cursor)
-                    fprintf(fp, " ");
-                for (; cursor < info_p_arr[i]->left_margin; ++cursor)
-                    fprintf(fp, "%c", horiz_conj_char);
-            }
-            else
-            { //没有左孩子全打印空格即可
-                for (; cursor < info_p_arr[i]->left_margin; ++cursor)
-                    fprintf(fp, " ");
-            }
+        BTreePrintCtx tmp_ctx;
+        int ret;
+        btree_print_ctx_init(&tmp_ctx);
+        ret = btree_visual_print_snapshot(&tmp_ctx, root, elem_fmt, sink, user);
+        btree_print_ctx_free(&tmp_ctx);
+        return ret;
+    }
+    if (_btree_visual_print_fill(ctx, root, elem_fmt, 0) < 0 || _btree_print_layout(ctx) < 0)
+        return -1;
+    return btree_print_snapshot_write(ctx, sink, user);
+}
 
-            //打印元素
-            fprintf(fp, "%c", left_bracket_char);
-            fprintf(fp, elem_fmt, p->data); //这里要注意TODO:
-            fprintf(fp, "%c", right_bracket_char);
-            cursor += info_p_arr[i]->str_len;
+#if defined(__unix__) || defined(__APPLE__)
+/* 外存打印的层序遍历: 结点记录写进临时文件, 元素每次只在ctx->label_pool里格式化一个 */
+static int _btree_visual_print_spill(BTreePrintCtx *ctx, _BTreePrintSpill *sp, const BTree root, const char *elem_fmt)
+{
+    const void *address;
+    BTree p;
+    int ret, len;
+    if (_btree_print_spill_begin(sp, root) < 0)
+        return -1;
+    while ((ret = _btree_print_spill_pop(sp, &address)) > 0)
+    {
+        p = (BTree)address;
+        ctx->label_len = 0;
+        if ((len = _btree_print_format(ctx, elem_fmt, p->data)) < 0) // TODO: 注意
+            return -1;
+        if (_btree_print_spill_node(sp, ctx->label_pool, len, p->lchild, p->rchild) < 0)
+            return -1;
+    }
+    return ret;
+}
 
-            //打印右边
-            if (p->rchild != NULL)
-            {
-                for (j = 0; j < node_count; ++j)
-                {
-                    if (info_p_arr[j]->address == p->rchild)
-                    {
-                        horiz_right_end = info_p_arr[j]->left_margin + info_p_arr[j]->str_len / 2;
-                        vert_index_arr[++k] = horiz_right_end;
-                        break;
-                    }
-                }
-                for (; cursor < horiz_right_end; ++cursor)
-                    fprintf(fp, "%c", horiz_conj_char);
-            } //右边没有else ,因为只考虑横线即可, 空白算到同层下一个元素左边
-
-            if (++i >= node_count)
-            {
-                end_flag = 1; //打印完最后一个元素, 下一行不需要竖线了,提前结束
-                break;
-            }
+/**
+ * @brief 内存有硬上限的打印: ctx的缓冲区在mem_cap以内放得下就和btree_visual_print_sink一样在内存里打印;
+ *        放不下就改成外存打印, 每个结点的长度, 孩子, 元素字符串, 子树宽度和横坐标都写进tmp_dir里的临时文件,
+ *        层序遍历, 算宽度, 算横坐标, 逐行输出都是一层一层顺序读写这些文件, 所以内存占用和树有多大无关, 速度取决于磁盘
+ *        两种情况的输出和btree_visual_print_sink一字不差; 总是中序排版, 不看ctx->layout
+ *        临时文件建好就unlink, 不会留下垃圾, 占的磁盘空间大约每个结点40字节加上元素字符串
+ *
+ * @param ctx 同btree_visual_print_sink, 传NULL则临时申请一个; 原有的缓冲区超过mem_cap时会先释放掉
+ * @param mem_cap 打印时申请的内存一共不超过这么多字节, 至少要有几十KB, 每个临时文件的读写缓冲区至少BTREE_PRINT_SPILL_MIN_BUF
+ * @param tmp_dir 临时文件放在哪个目录, 传NULL用环境变量TMPDIR, 没有就是/tmp
+ * @param sink 外存打印时sink每次收到的是攒满一个缓冲区的一大块, 可能包含很多行, 也可能只是一行的一部分
+ * @return 0成功, -1内存不足, 临时文件读写失败或sink返回失败; 在内存里放不下不算失败
+ * @example
+ *      btree_visual_print_external(NULL, t, "%d", 64 << 20, "/var/tmp", btree_print_sink_file, stdout);
+ */
+int btree_visual_print_external(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, size_t mem_cap, const char *tmp_dir,
+                                btree_print_sink_fn sink, void *user)
+{
+    _BTreePrintSpill sp;
+    size_t old_cap;
+    int old_layout, ret;
+    if (ctx == NULL)
+    {
+        BTreePrintCtx tmp_ctx;
+        btree_print_ctx_init(&tmp_ctx);
+        ret = btree_visual_print_external(&tmp_ctx, root, elem_fmt, mem_cap, tmp_dir, sink, user);
+        btree_print_ctx_free(&tmp_ctx);
+        return ret;
+    }
+    old_cap = ctx->mem_cap;
+    old_layout = ctx->layout;
+    if (_btree_print_mem(ctx) > mem_cap)
+        btree_print_ctx_free(ctx);
+    ctx->mem_cap = mem_cap;
+    ctx->mem_over = 0;
+    ctx->layout = BTREE_PRINT_LAYOUT_INORDER;
+
+    //先在内存里试, 超过上限时还在层序遍历或者排版, 一个字都没输出, 可以放心换成外存打印
+    ret = btree_visual_print_sink(ctx, root, elem_fmt, sink, user);
+    if (ret < 0 && ctx->mem_over)
+    {
+        btree_print_ctx_free(ctx);
+        ret = _btree_print_spill_open(&sp, tmp_dir, mem_cap);
+        if (ret == 0)
+        { //流的缓冲区之外剩下的留给格式化元素
+            ctx->mem_cap = mem_cap > sp.block_size + 4096 ? mem_cap - sp.block_size : 4096;
+            ret = _btree_visual_print_spill(ctx, &sp, root, elem_fmt) < 0 ? -1 : _btree_print_spill_render(&sp, sink, user);
+            _btree_print_spill_close(&sp);
         }
-        fprintf(fp, "\n");
+    }
+    ctx->mem_cap = old_cap;
+    ctx->layout = old_layout;
+    return ret;
+}
+#endif
+
+#ifdef BTREE_PRINT_PTHREAD
+/* 多线程打印时各线程格式化元素用 */
+static int _btree_visual_print_label(BTreePrintCtx *pool, const void *address, const char *elem_fmt)
+{
+    return _btree_print_format(pool, elem_fmt, ((BTree)address)->data); // TODO: 注意
+}
+
+/**
+ * @brief 多线程版的btree_visual_print_stats, 输出和单线程一字不差, 给上百万个结点的大树用
+ *        层序遍历还是单线程, 格式化元素, 算横坐标, 拼每一行都分给nthreads个线程(含调用者), 见_btree_print_render_parallel
+ *        需要在include之前定义BTREE_PRINT_PTHREAD, 编译时加-pthread
+ *
+ * @param nthreads 线程数, 小于等于1时就是btree_visual_print_stats
+ * @param sink 注意多线程时sink每次收到的是按顺序拼好的一大块, 可能包含很多行, 也可能只是一行的一部分
+ * @param stats 同btree_visual_print_stats, 可以传NULL; bfs_ns包括并行格式化元素的时间
+ * @return 0成功, -1内存不足或sink返回失败
+ * @example
+ *      #define BTREE_PRINT_PTHREAD
+ *      #include "btree_visual_print.h"
+ *
+ *      btree_visual_print_parallel(NULL, t, "%d", 8, btree_print_sink_file, stdout, NULL);
+ */
+int btree_visual_print_parallel(BTreePrintCtx *ctx, const BTree root, const char *elem_fmt, int nthreads, btree_print_sink_fn sink,
+                                void *user, BTreePrintStats *stats)
+{
+    if (nthreads <= 1)
+        return btree_visual_print_stats(ctx, root, elem_fmt, sink, user, stats);
+    if (ctx == NULL)
+    {
+        BTreePrintCtx tmp_ctx;
+        int ret;
+        btree_print_ctx_init(&tmp_ctx);
+        ret = btree_visual_print_parallel(&tmp_ctx, root, elem_fmt, nthreads, sink, user, stats);
+        btree_print_ctx_free(&tmp_ctx);
+        return ret;
+    }
+    if (stats != NULL)
+        _btree_print_stats_begin(ctx, stats);
+    if (_btree_visual_print_fill(ctx, root, NULL, 0) < 0)
+        return -1;
+    return _btree_print_render_parallel(ctx, _btree_visual_print_label, elem_fmt, nthreads, sink, user, stats);
+}
 
-        //打印竖线
-        if (!end_flag)
+/**
+ * @brief 异步打印: 调用者只做层序遍历, 把元素字符串和树的形状拷进队列里的一个ctx就返回, 排版和输出在后台线程里做
+ *        返回之后树就可以改或者释放了; 调用者一侧的耗时和树的大小成正比, 和输出多慢无关, 见btree_print_async_stats
+ *        需要在include之前定义BTREE_PRINT_PTHREAD, 编译时加-pthread
+ *
+ * @param async 用btree_print_async_init初始化过的异步打印器
+ * @param max_depth 同btree_visual_print_summary, 大于0时只拷前max_depth层, 大树也能把调用者一侧的耗时限制住
+ * @param sink 在后台线程里调用; user在输出完之前要一直有效, 需要时用btree_print_async_flush等一下
+ * @return 0已排进队列, 1队列满了按BTREE_PRINT_ASYNC_DROP丢掉了, -1内存不足
+ *         输出失败时调用者已经返回了, 只会记进统计的failed
+ * @example
+ *      BTreePrintAsync async;
+ *      btree_print_async_init(&async, 8, BTREE_PRINT_ASYNC_DROP);
+ *      btree_visual_print_async(&async, t, "%d", 0, btree_print_sink_file, stderr);
+ *      btree_print_async_free(&async);
+ */
+int btree_visual_print_async(BTreePrintAsync *async, const BTree root, const char *elem_fmt, int max_depth, btree_print_sink_fn sink,
+                             void *user)
+{
+    unsigned long long t0 = _btree_print_now_ns();
+    int s = _btree_print_async_acquire(async, t0), ok;
+    if (s < 0)
+        return 1;
+    ok = _btree_visual_print_fill(&async->slot[s], root, elem_fmt, max_depth) == 0;
+    _btree_print_async_submit(async, s, ok, sink, user, t0);
+    return ok ? 0 : -1;
+}
+#endif
+
+/**
+ * @brief 从槽位s开始把句柄和真实的树对齐: 重新格式化s的元素, 孩子指针和缓存的不一样时,
+ *        旧孩子先记为可能被摘下, 新孩子查不到就新建槽位, 再对新孩子重复这一步; 和缓存一样的孩子不往下走
+ * @return 0成功, -1内存不足
+ */
+static int _btree_layout_sync(BTreeLayout *layout, int s)
+{
+    int top = 0, side, old, c;
+    int *cached;
+    BTree p, child;
+
+    if (_btree_layout_push(layout, &layout->stack, &layout->stack_cap, &top, s) < 0)
+        return -1;
+    while (top > 0)
+    {
+        s = layout->stack[--top];
+        p = (BTree)layout->address[s];
+        if (_btree_layout_set_label(layout, s, layout->elem_fmt, p->data) < 0) // TODO: 注意
+            return -1;
+        if (_btree_layout_push(layout, &layout->visited, &layout->visited_cap, &layout->visited_count, s) < 0)
+            return -1;
+
+        for (side = 0; side < 2; ++side)
         {
-            cursor = 0;
-            for (j = 0; j <= k; ++j)
+            child = side == 0 ? p->lchild : p->rchild;
+            cached = side == 0 ? layout->lchild : layout->rchild;
+            old = cached[s];
+            if (old >= 0 && layout->address[old] == (const void *)child)
+                continue;
+            if (old >= 0)
             {
-                for (; cursor < vert_index_arr[j]; ++cursor)
-                    fprintf(fp, " ");
-                fprintf(fp, "%c", vert_conj_char);
-                cursor++;
+                if (layout->parent[old] == s)
+                    layout->parent[old] = -1;
+                if (_btree_layout_push(layout, &layout->orphan, &layout->orphan_cap, &layout->orphan_count, old) < 0)
+                    return -1;
             }
-            fprintf(fp, "\n");
+            cached[s] = -1;
+            if (child == NULL)
+                continue;
+            if ((c = _btree_layout_map_get(layout, child)) < 0 && (c = _btree_layout_new_slot(layout, child)) < 0)
+                return -1;
+            cached = side == 0 ? layout->lchild : layout->rchild; /* 新建槽位可能让arena搬家 */
+            cached[s] = c;
+            layout->parent[c] = s;
+            if (_btree_layout_push(layout, &layout->stack, &layout->stack_cap, &top, c) < 0)
+                return -1;
         }
-        cur_depth++;
     }
-    for (i = 0; i < node_count; ++i)
-        free(info_p_arr[i]); //释放空间
-    return;
+    return 0;
+}
+
+/**
+ * @brief 按root这棵树重建整个句柄, 之前缓存的都丢掉
+ *
+ * @param layout 用btree_layout_init初始化过的句柄
+ * @param elem_fmt 同btree_visual_print, 句柄只保存这个指针, 之后btree_layout_update一直用它
+ * @return 0成功, -1内存不足(此时句柄为空树, 可以再build一次)
+ */
+int btree_layout_build(BTreeLayout *layout, const BTree root, const char *elem_fmt)
+{
+    _btree_layout_clear(layout);
+    layout->elem_fmt = elem_fmt;
+    return btree_layout_update(layout, root, root);
+}
+
+/**
+ * @brief 树改了一步之后只更新受影响的部分, 代价和改动的结点数加上树高成正比, 不是O(n)
+ *        从changed往下, 只有孩子指针和缓存不一样的地方才会往下走; 再从changed往上重算子树宽度直到根,
+ *        右边那些结点的横坐标打印时由子树宽度推出, 不用逐个修改
+ *
+ * @param root 改动之后的根, 和上次不一样(根被删, 根上旋转, 空树插入)时会自动处理
+ * @param changed 孩子指针或元素被改动的那个结点:
+ *                插入 -- 新结点的父亲; 删除 -- 被删结点原来的父亲; 旋转 -- 旋转前子树根的父亲(旋转在根上时传新根)
+ *                两个孩子的结点删除时(拷贝后继的值再删后继), 对该结点和后继的父亲各调用一次
+ *                只改了元素的值时传该结点本身; 传NULL或句柄里没有的结点就整棵重建
+ * @return 0成功, -1内存不足(此时句柄内容不确定, 需要重新build)
+ * @example
+ *      insert(&t, 42);                        // 42挂在了p下面
+ *      btree_layout_update(&layout, t, p);
+ *      btree_layout_print(&layout, btree_print_sink_file, stdout);
+ */
+int btree_layout_update(BTreeLayout *layout, const BTree root, const BTree changed)
+{
+    int s, rs = -1;
+
+    _btree_layout_begin(layout);
+    if (root == NULL)
+    {
+        _btree_layout_clear(layout);
+        return 0;
+    }
+    if ((s = changed != NULL ? _btree_layout_map_get(layout, changed) : -1) < 0 && layout->root >= 0)
+        return btree_layout_build(layout, root, layout->elem_fmt);
+
+    if (layout->root < 0 || layout->address[layout->root] != (const void *)root)
+    {
+        //换根了: 旧根记为可能被摘下, 新根查不到就新建, 从新根同步一遍
+        if (layout->root >= 0 &&
+            _btree_layout_push(layout, &layout->orphan, &layout->orphan_cap, &layout->orphan_count, layout->root) < 0)
+            return -1;
+        if ((rs = _btree_layout_map_get(layout, root)) < 0 && (rs = _btree_layout_new_slot(layout, root)) < 0)
+            return -1;
+        layout->parent[rs] = -1;
+        layout->root = rs;
+        if (_btree_layout_sync(layout, rs) < 0)
+            return -1;
+    }
+    if (s >= 0 && s != rs && _btree_layout_sync(layout, s) < 0)
+        return -1;
+    return _btree_layout_finish(layout, s);
 }
@@ -0,0 +1,276 @@
+/**
+ * @file btree_visual_print.hpp
+ * @brief 可视化打印二叉树的C++模板版本: 结点类型, 取孩子和取数据的方式都是模板参数, 元素用std::to_chars格式化
+ * @version 1.0
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * 需要C++17, 只用包含本文件, 不用包含btree_visual_print.h
+ * 和函数版本比: 不用改结点的名字, 孩子可以是裸指针, std::unique_ptr或std::shared_ptr,
+ * 取孩子和数据的函数可以内联, 格式化元素不再解析格式字符串; 排版和输出还是btree_visual_print_core.h那一套, 输出一字不差
+ */
+
+#ifndef BTREE_VISUAL_PRINT_HPP
+#define BTREE_VISUAL_PRINT_HPP
+
+// std=C++17
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "btree_visual_print_core.h"
+
+/**
+ * @brief 取孩子和数据的默认方式, 默认用成员lchild, rchild, data, 和函数版本的结点一样
+ *        成员名字不一样时, 可以给自己的结点类型特化这个模板, 也可以打印时传btree_print_access(...)
+ * @example
+ *      template <> struct btree_print_traits<RBNode>
+ *      {
+ *          static const RBNode *left(const RBNode &n) { return n.left; }
+ *          static const RBNode *right(const RBNode &n) { return n.right; }
+ *          static int data(const RBNode &n) { return n.key; }
+ *      };
+ */
+template <class Node>
+struct btree_print_traits
+{
+    static auto left(const Node &n) -> decltype((n.lchild)) { return n.lchild; }
+    static auto right(const Node &n) -> decltype((n.rchild)) { return n.rchild; }
+    static auto data(const Node &n) -> decltype((n.data)) { return n.data; }
+};
+
+/* 默认的取值方式, 转给btree_print_traits */
+struct btree_print_default_access
+{
+    template <class Node>
+    auto left(const Node &n) const -> decltype(btree_print_traits<Node>::left(n)) { return btree_print_traits<Node>::left(n); }
+    template <class Node>
+    auto right(const Node &n) const -> decltype(btree_print_traits<Node>::right(n)) { return btree_print_traits<Node>::right(n); }
+    template <class Node>
+    auto data(const Node &n) const -> decltype(btree_print_traits<Node>::data(n)) { return btree_print_traits<Node>::data(n); }
+};
+
+/* 用三个可调用对象取左孩子, 右孩子和数据, 由btree_print_access生成 */
+template <class Left, class Right, class Data>
+struct btree_print_accessors
+{
+    Left l;
+    Right r;
+    Data d;
+    template <class Node>
+    decltype(auto) left(const Node &n) const { return l(n); }
+    template <class Node>
+    decltype(auto) right(const Node &n) const { return r(n); }
+    template <class Node>
+    decltype(auto) data(const Node &n) const { return d(n); }
+};
+
+/**
+ * @brief 用三个lambda指定怎么取左孩子, 右孩子和数据, 不用改结点类型, 也不用写包装
+ *        孩子返回裸指针, 或者返回std::unique_ptr / std::shared_ptr的引用都可以, 不能按值返回std::unique_ptr
+ * @example
+ *      auto acc = btree_print_access([](const Node &n) -> auto & { return n.kids[0]; },
+ *                                    [](const Node &n) -> auto & { return n.kids[1]; },
+ *                                    [](const Node &n) { return n.key; });
+ *      btree_visual_print(&ctx, root, btree_print_sink_file, stdout, acc);
+ */
+template <class Left, class Right, class Data>
+btree_print_accessors<Left, Right, Data> btree_print_access(Left l, Right r, Data d)
+{
+    return btree_print_accessors<Left, Right, Data>{l, r, d};
+}
+
+/* 孩子指针统一转成const Node*, 空孩子是nullptr */
+template <class Node>
+const Node *_btree_print_ptr(const Node *p) { return p; }
+template <class Node, class Deleter>
+const Node *_btree_print_ptr(const std::unique_ptr<Node, Deleter> &p) { return p.get(); }
+template <class Node>
+const Node *_btree_print_ptr(const std::shared_ptr<Node> &p) { return p.get(); }
+
+/* 把len个字节写进buf, 放不下只写cap个, 返回len, 和snprintf一个意思 */
+static inline int _btree_print_copy_label(char *buf, size_t cap, const char *src, size_t len)
+{
+    if (cap > 0)
+        memcpy(buf, src, len < cap ? len : cap);
+    return (int)len;
+}
+
+/**
+ * @brief 默认的元素格式化, 不解析格式字符串: 整数和浮点数用std::to_chars, char原样输出, 字符串直接拷贝
+ *        浮点数是能精确还原的最短写法, 比如0.1, 1e+20, 和printf的%f, %g不一定一样; 标准库不支持浮点to_chars时退回%g
+ *        其他类型编译报错, 这时自己写一个格式化函数传进来, 约定同下
+ *
+ * @param buf 写到这里, 可能是nullptr
+ * @param cap buf能放几个字节, 可以写满, 也可以像snprintf那样留一个给'\0'
+ * @return 完整的长度, 大于等于cap时会扩容, 再用cap = 长度 + 1调用一次; 负数表示失败
+ */
+struct btree_print_format
+{
+    template <class T>
+    int operator()(char *buf, size_t cap, const T &v) const
+    {
+        using U = std::remove_cv_t<std::remove_reference_t<T>>;
+        if constexpr (std::is_same_v<U, char>)
+            return _btree_print_copy_label(buf, cap, &v, 1);
+        else if constexpr (std::is_same_v<U, bool>)
+            return v ? _btree_print_copy_label(buf, cap, "true", 4) : _btree_print_copy_label(buf, cap, "false", 5);
+        else if constexpr (std::is_integral_v<U>)
+        {
+            char tmp[64];
+            std::to_chars_result res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+            return _btree_print_copy_label(buf, cap, tmp, (size_t)(res.ptr - tmp));
+        }
+        else if constexpr (std::is_floating_point_v<U>)
+        {
+            char tmp[64];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+            std::to_chars_result res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+            if (res.ec == std::errc())
+                return _btree_print_copy_label(buf, cap, tmp, (size_t)(res.ptr - tmp));
+#endif
+            int len = snprintf(tmp, sizeof(tmp), "%Lg", (long double)v);
+            return len < 0 ? -1 : _btree_print_copy_label(buf, cap, tmp, (size_t)len);
+        }
+        else if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>)
+            return v != nullptr ? _btree_print_copy_label(buf, cap, v, strlen(v)) : _btree_print_copy_label(buf, cap, "(null)", 6);
+        else if constexpr (std::is_convertible_v<const U &, std::string_view>)
+        {
+            std::string_view s = v;
+            return _btree_print_copy_label(buf, cap, s.data(), s.size());
+        }
+        else
+        {
+            static_assert(sizeof(U) == 0, "btree_print_format: unsupported element type, pass your own formatter");
+            return -1;
+        }
+    }
+};
+
+/* 用format把第index个结点的元素写进label_pool, 顺便记下打印长度; 一般只调用一次format, 放不下才扩容再调用一次 */
+template <class Format, class T>
+int _btree_print_put_label_tpl(BTreePrintCtx *ctx, int index, const Format &format, const T &v)
+{
+    size_t room = ctx->label_cap - ctx->label_len;
+    int len = format(room > 0 ? ctx->label_pool + ctx->label_len : nullptr, room, v);
+    if (len >= 0 && (size_t)len >= room)
+    { // 放不下, 或者像snprintf那样正好没地方放'\0', 扩容后再格式化一次; 和_btree_print_vformat一样多给一个字节
+        char *pool = (char *)_btree_print_grow(ctx, ctx->label_pool, &ctx->label_cap, ctx->label_len + (size_t)len + 1, 1);
+        if (pool == nullptr)
+            return -1;
+        ctx->label_pool = pool;
+        len = format(pool + ctx->label_len, (size_t)len + 1, v);
+    }
+    if (len < 0)
+        return -1;
+    ctx->label_off[index] = ctx->label_len;
+    ctx->str_len[index] = len + 2; // 计算打印后的元素长度, 加上两个括号
+    ctx->label_len += (size_t)len;
+    return 0;
+}
+
+/**
+ * @brief 层序遍历, 把root这棵树的结点信息表和元素字符串填进ctx, 和函数版本的_btree_visual_print_fill一样, 只是结点类型是模板参数
+ * @return 0成功, -1内存不足或format失败
+ */
+template <class Node, class Access, class Format>
+int _btree_visual_print_fill_tpl(BTreePrintCtx *ctx, const Node *root, const Access &access, const Format &format)
+{
+    int front, child;
+    const Node *p, *c;
+    _btree_print_reset(ctx);
+    if (root == nullptr)
+        return 0;
+
+    // ctx->address本身就是队列, 结点的下标就是它的层序序号, 孩子入队时顺手记下孩子的下标
+    if (_btree_print_push_info(ctx, root, 1) < 0)
+        return -1;
+    for (front = 0; front < ctx->node_count; ++front)
+    {
+        p = static_cast<const Node *>(ctx->address[front]);
+        if (_btree_print_put_label_tpl(ctx, front, format, access.data(*p)) < 0)
+            return -1;
+        if ((c = _btree_print_ptr(access.left(*p))) != nullptr)
+        {
+            if ((child = _btree_print_push_info(ctx, c, ctx->depth[front] + 1)) < 0)
+                return -1;
+            ctx->lchild[front] = child;
+        }
+        if ((c = _btree_print_ptr(access.right(*p))) != nullptr)
+        {
+            if ((child = _btree_print_push_info(ctx, c, ctx->depth[front] + 1)) < 0)
+                return -1;
+            ctx->rchild[front] = child;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 可视化打印二叉树, 模板版本, 输出和btree_visual_print_sink一字不差
+ *
+ * @param ctx 用btree_print_ctx_init初始化过的缓冲区, 传nullptr则临时申请一个
+ * @param root 根结点, 裸指针或者std::unique_ptr / std::shared_ptr
+ * @param sink 输出函数, 见btree_print_sink_file, btree_print_sink_buf, btree_print_sink_string等
+ * @param user 原样传给sink
+ * @param access 怎么取孩子和数据, 默认见btree_print_traits, 也可以用btree_print_access传lambda
+ * @param format 怎么把数据写成字符串, 默认见btree_print_format
+ * @param stats 同btree_visual_print_stats, 不需要时传nullptr
+ * @return 0成功, -1内存不足, format失败或sink返回失败
+ * @example
+ *      struct Node
+ *      {
+ *          int data;
+ *          std::unique_ptr<Node> lchild, rchild;
+ *      };
+ *
+ *      std::string out;
+ *      btree_visual_print(nullptr, root, btree_print_sink_string, &out);
+ *
+ *      btree_visual_print(&ctx, root, btree_print_sink_file, stdout, btree_print_default_access(),
+ *                         [](char *buf, size_t cap, int v) { return snprintf(buf, cap, "%04x", v); });
+ */
+template <class Node, class Access = btree_print_default_access, class Format = btree_print_format>
+int btree_visual_print(BTreePrintCtx *ctx, const Node *root, btree_print_sink_fn sink, void *user, const Access &access = Access(),
+                       const Format &format = Format(), BTreePrintStats *stats = nullptr)
+{
+    if (ctx == nullptr)
+    {
+        BTreePrintCtx tmp_ctx;
+        int ret;
+        btree_print_ctx_init(&tmp_ctx);
+        ret = btree_visual_print(&tmp_ctx, root, sink, user, access, format, stats);
+        btree_print_ctx_free(&tmp_ctx);
+        return ret;
+    }
+    if (stats != nullptr)
+        _btree_print_stats_begin(ctx, stats);
+    if (_btree_visual_print_fill_tpl(ctx, root, access, format) < 0)
+        return -1;
+
+    // 接下来中序遍历统计横坐标, 然后逐行打印, 和C版本共用, 见btree_visual_print_core.h
+    return _btree_print_render(ctx, sink, user, stats);
+}
+
+/* 根结点是std::unique_ptr */
+template <class Node, class Deleter, class Access = btree_print_default_access, class Format = btree_print_format>
+int btree_visual_print(BTreePrintCtx *ctx, const std::unique_ptr<Node, Deleter> &root, btree_print_sink_fn sink, void *user,
+                       const Access &access = Access(), const Format &format = Format(), BTreePrintStats *stats = nullptr)
+{
+    return btree_visual_print(ctx, _btree_print_ptr(root), sink, user, access, format, stats);
+}
+
+/* 根结点是std::shared_ptr */
+template <class Node, class Access = btree_print_default_access, class Format = btree_print_format>
+int btree_visual_print(BTreePrintCtx *ctx, const std::shared_ptr<Node> &root, btree_print_sink_fn sink, void *user,
+                       const Access &access = Access(), const Format &format = Format(), BTreePrintStats *stats = nullptr)
+{
+    return btree_visual_print(ctx, _btree_print_ptr(root), sink, user, access, format, stats);
+}
+
+#endif
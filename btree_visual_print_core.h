@@ -0,0 +1,3389 @@
+/**
+ * @file btree_visual_print_core.h
+ * @brief 可视化打印二叉树的公共部分: 工作缓冲区, 中序遍历和逐行打印, 与结点类型无关
+ * @version 1.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * 函数版本, 纯宏版本和C++模板版本都会包含本文件, 一般不需要直接包含
+ */
+
+#ifndef BTREE_VISUAL_PRINT_CORE_H
+#define BTREE_VISUAL_PRINT_CORE_H
+
+/*  std=C99 */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __cplusplus
+/* -std=c99这种严格模式下stdlib.h不声明mkstemp, 补一个和POSIX一致的声明 */
+int mkstemp(char *path_template);
+#endif
+#endif
+#ifdef __cplusplus
+#include <string>
+#endif
+
+/**
+ * @brief 打印用的工作缓冲区, 全部在堆上按需增长, 由调用者持有
+ *        多次打印复用同一个ctx就不会反复申请内存, 用完调用btree_print_ctx_free
+ *
+ *        结点信息表按层序序号下标, 每个字段各存一个平行数组(而不是每个结点一个结构体),
+ *        所有按结点个数分配的数组都切在arena这一整块内存里, 逐层打印时访问的都是连续内存
+ * @example
+ *      BTreePrintCtx ctx;
+ *      btree_print_ctx_init(&ctx);
+ *      btree_visual_print_ctx(&ctx, t1, "%c", stdout);
+ *      btree_visual_print_ctx(&ctx, t2, "%c", stdout);
+ *      btree_print_ctx_free(&ctx);
+ */
+typedef struct btree_print_ctx
+{
+    const void **address; /* 结点地址, 层序遍历时取孩子和数据用; 这个数组本身也是层序遍历的队列 */
+    size_t *label_off;    /* 元素打印成的字符串在label_pool中的偏移, 只格式化这一次 */
+    int *str_len;
+    int *depth;
+    int *left_margin;    /* horizontal coordintate */
+    int *lchild;         /* 左孩子的下标, 没有则为-1 */
+    int *rchild;         /* 右孩子的下标, 没有则为-1 */
+    int *index_stack;    /* 中序遍历用的下标栈 */
+    int *vert_index_arr; /* 偶数行的竖线存储数组 */
+    void *arena;         /* 上面这些数组都在这一块里 */
+    size_t node_cap;     /* arena能放下的结点个数 */
+    int node_count;
+    int horizontal_accumu_cache; /* 中序遍历得到的横坐标累计长度, 也就是画布宽度 */
+    char *label_pool; /* 所有元素打印成的字符串首尾相接存在这里, 打印时直接拷贝 */
+    size_t label_len;
+    size_t label_cap;
+    char *line; /* 行缓冲区, 一整行拼好后一次写出 */
+    size_t line_cap;
+    size_t alloc_count; /* 一共申请过几次内存; 复用ctx打印同样大小的树时应该保持不变 */
+    const void **walk_stack; /* 折叠的子树数结点个数时用的指针栈 */
+    size_t walk_cap;
+    int layout;   /* 排版方式, 见enum btree_print_layout, 初始化后是中序排版 */
+    int *scratch; /* 紧凑排版用的工作数组 */
+    size_t scratch_cap;
+    size_t mem_cap; /* 上面这些缓冲区加起来最多占多少字节, 0表示不限; 见btree_visual_print_external */
+    int mem_over;   /* 因为超过mem_cap而申请失败过, 和真的内存不足区分开 */
+} BTreePrintCtx;
+
+/**
+ * @brief 排版方式, 打印前设置ctx.layout
+ *        BTREE_PRINT_LAYOUT_INORDER 默认, 中序遍历累加横坐标, 每个结点独占一段列, 画布宽度随结点个数线性增长
+ *        BTREE_PRINT_LAYOUT_TIDY    紧凑排版, 不同子树的结点在同一行不重叠就可以共用列, 稀疏的深树能窄很多
+ */
+enum btree_print_layout
+{
+    BTREE_PRINT_LAYOUT_INORDER = 0,
+    BTREE_PRINT_LAYOUT_TIDY = 1
+};
+
+/* 紧凑排版时同一行相邻两棵子树之间至少空几列 */
+#ifndef BTREE_PRINT_TIDY_GAP
+#define BTREE_PRINT_TIDY_GAP 2
+#endif
+
+/**
+ * @brief 一次打印的统计信息, 需要时把地址传给btree_visual_print_stats / BTREE_VISUAL_PRINT_STATS
+ *        不需要时传NULL, 走的是不带统计的那一份代码; 定义BTREE_PRINT_NO_STATS则统计整个不编译, 见_btree_print_render
+ */
+typedef struct btree_print_stats
+{
+    int node_count;
+    int max_depth;
+    int horizontal_accumu_cache; /* 画布总宽度 */
+    size_t bytes_emitted;
+    size_t lines_emitted;
+    size_t allocations; /* 这次打印申请内存的次数, 复用ctx时一般是0 */
+    unsigned long long bfs_ns;     /* 层序遍历, 包括格式化元素 */
+    unsigned long long inorder_ns; /* 中序遍历算横坐标 */
+    unsigned long long emit_ns;    /* 逐行拼接并交给sink, 包括sink本身的耗时 */
+} BTreePrintStats;
+
+/**
+ * @brief 输出目的地, 每拼好一行调用一次, 把buf中的len个字节写出去
+ * @return 0成功, 非0表示写失败, 打印会就此停止
+ */
+typedef int (*btree_print_sink_fn)(void *user, const char *buf, size_t len);
+
+/* 写到FILE*, user就是FILE* */
+static inline int btree_print_sink_file(void *user, const char *buf, size_t len)
+{
+    return fwrite(buf, 1, len, (FILE *)user) == len ? 0 : -1;
+}
+
+/* 内存缓冲区, data始终以'\0'结尾, 用完free(data)即可 */
+typedef struct btree_print_buf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} BTreePrintBuf;
+
+/* 追加到内存缓冲区, user是BTreePrintBuf* */
+static inline int btree_print_sink_buf(void *user, const char *buf, size_t len)
+{
+    BTreePrintBuf *out = (BTreePrintBuf *)user;
+    if (out->len + len + 1 > out->cap)
+    {
+        size_t new_cap = out->cap > 0 ? out->cap : 256;
+        char *new_data;
+        while (new_cap < out->len + len + 1)
+            new_cap *= 2;
+        new_data = (char *)realloc(out->data, new_cap);
+        if (new_data == NULL)
+            return -1;
+        out->data = new_data;
+        out->cap = new_cap;
+    }
+    memcpy(out->data + out->len, buf, len);
+    out->len += len;
+    out->data[out->len] = '\0';
+    return 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/* 直接write到文件描述符, 不经过stdio, user是int*指向fd */
+static inline int btree_print_sink_fd(void *user, const char *buf, size_t len)
+{
+    int fd = *(int *)user;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+#endif
+
+#ifdef __cplusplus
+/* 追加到std::string, user是std::string* */
+static inline int btree_print_sink_string(void *user, const char *buf, size_t len)
+{
+    static_cast<std::string *>(user)->append(buf, len);
+    return 0;
+}
+#endif
+
+/**
+ * @brief 动画输出: 一步一步打印同一棵树时, 只把和上一帧不一样的地方用ANSI光标定位补上去, 而不是整棵树重新刷一遍
+ *        本身是一个sink, 任何打印函数都可以往里写, 一帧写完调用btree_print_frame_end
+ *        第一帧, 行数变了(树高变了), 或者改动比整帧还多时, 清屏整帧重画; 终端要关掉自动换行, 否则太宽的行会错位
+ * @example
+ *      BTreePrintFrame frame;
+ *      btree_print_frame_init(&frame, btree_print_sink_file, stdout);
+ *      for (each step)
+ *      {
+ *          insert(&t, key);
+ *          btree_visual_print_sink(&ctx, t, "%d", btree_print_sink_frame, &frame);
+ *          btree_print_frame_end(&frame);
+ *          fflush(stdout);
+ *      }
+ *      btree_print_frame_free(&frame);
+ */
+typedef struct btree_print_frame
+{
+    BTreePrintBuf prev; /* 上一帧, 终端上现在显示的就是它 */
+    BTreePrintBuf cur;  /* 这一帧, 打印时写到这里 */
+    BTreePrintBuf out;  /* 这一帧要发给终端的字节 */
+    int prev_rows;      /* 上一帧的行数, -1表示下一帧整帧重画 */
+    btree_print_sink_fn sink;
+    void *user;
+    size_t bytes_emitted; /* 上一次btree_print_frame_end发出去的字节数 */
+} BTreePrintFrame;
+
+/* 两处改动之间相同的字节不超过这么多就连成一段输出, 比多发一个光标定位便宜 */
+#ifndef BTREE_PRINT_FRAME_GAP
+#define BTREE_PRINT_FRAME_GAP 8
+#endif
+
+static inline void btree_print_frame_init(BTreePrintFrame *frame, btree_print_sink_fn sink, void *user)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->prev_rows = -1;
+    frame->sink = sink;
+    frame->user = user;
+}
+
+static inline void btree_print_frame_free(BTreePrintFrame *frame)
+{
+    free(frame->prev.data);
+    free(frame->cur.data);
+    free(frame->out.data);
+    memset(frame, 0, sizeof(*frame));
+    frame->prev_rows = -1;
+}
+
+/* 下一帧整帧重画, 比如终端被别的输出弄乱了 */
+static inline void btree_print_frame_reset(BTreePrintFrame *frame)
+{
+    frame->prev_rows = -1;
+}
+
+/* 收集这一帧, user是BTreePrintFrame* */
+static inline int btree_print_sink_frame(void *user, const char *buf, size_t len)
+{
+    return btree_print_sink_buf(&((BTreePrintFrame *)user)->cur, buf, len);
+}
+
+/* 从s开始这一行的行尾, 最后一行没有换行时就是e */
+static inline const char *_btree_print_frame_eol(const char *s, const char *e)
+{
+    const char *nl = (const char *)memchr(s, '\n', (size_t)(e - s));
+    return nl != NULL ? nl : e;
+}
+
+/* 往out里追加光标定位, row和col从0开始 */
+static inline int _btree_print_frame_move(BTreePrintFrame *frame, int row, size_t col)
+{
+    char esc[48];
+    int len = snprintf(esc, sizeof(esc), "\033[%d;%luH", row + 1, (unsigned long)col + 1);
+    return btree_print_sink_buf(&frame->out, esc, (size_t)len);
+}
+
+/**
+ * @brief 一帧写完了, 和上一帧逐行比较, 只把变了的几段发给sink, 最后光标停在树的下面一行
+ * @return 0成功, -1内存不足或sink返回失败, 这时下一帧会整帧重画
+ */
+static inline int btree_print_frame_end(BTreePrintFrame *frame)
+{
+    const char *c = frame->cur.data, *ce = c + frame->cur.len, *p = frame->prev.data, *pe, *cl, *pl;
+    size_t clen, plen, n, i, j, last;
+    int rows = 0, row, ok = 1;
+    BTreePrintBuf tmp;
+
+    for (cl = c; cl < ce; rows++)
+        cl = _btree_print_frame_eol(cl, ce) + 1;
+    frame->out.len = 0;
+    if (frame->prev_rows == rows)
+    {
+        pe = p + frame->prev.len;
+        for (row = 0; ok && row < rows; ++row)
+        {
+            cl = _btree_print_frame_eol(c, ce);
+            pl = _btree_print_frame_eol(p, pe);
+            clen = (size_t)(cl - c);
+            plen = (size_t)(pl - p);
+            n = clen < plen ? clen : plen;
+            for (i = 0; ok && i < clen; i = j)
+            {
+                if (i < n && c[i] == p[i])
+                {
+                    j = i + 1;
+                    continue;
+                }
+                /* 一段改动从i开始, 后面相同的字节不超过BTREE_PRINT_FRAME_GAP就接着算进来 */
+                for (last = i, j = i + 1; j < clen && j - last <= BTREE_PRINT_FRAME_GAP; ++j)
+                    if (j >= n || c[j] != p[j])
+                        last = j;
+                j = last + 1;
+                ok = _btree_print_frame_move(frame, row, i) == 0 && btree_print_sink_buf(&frame->out, c + i, j - i) == 0;
+            }
+            if (ok && plen > clen) /* 这一行变短了, 擦掉行尾 */
+                ok = _btree_print_frame_move(frame, row, clen) == 0 && btree_print_sink_buf(&frame->out, "\033[K", 3) == 0;
+            c = cl + 1;
+            p = pl + 1;
+        }
+        if (ok && frame->out.len > 0)
+            ok = _btree_print_frame_move(frame, rows, 0) == 0;
+    }
+    if (ok && (frame->prev_rows != rows || frame->out.len > frame->cur.len + 7))
+    { /* 几何形状变了, 或者改的比整帧还多, 清屏整帧重画 */
+        frame->out.len = 0;
+        ok = btree_print_sink_buf(&frame->out, "\033[H\033[2J", 7) == 0 &&
+             (frame->cur.len == 0 || btree_print_sink_buf(&frame->out, frame->cur.data, frame->cur.len) == 0);
+    }
+    frame->bytes_emitted = 0;
+    if (ok && frame->out.len > 0)
+    {
+        ok = frame->sink(frame->user, frame->out.data, frame->out.len) == 0;
+        frame->bytes_emitted = frame->out.len;
+    }
+
+    /* 这一帧变成上一帧, 两块缓冲区对换, 不用重新申请 */
+    tmp = frame->prev;
+    frame->prev = frame->cur;
+    frame->cur = tmp;
+    frame->cur.len = 0;
+    frame->prev_rows = ok ? rows : -1;
+    return ok ? 0 : -1;
+}
+
+static inline void btree_print_ctx_init(BTreePrintCtx *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static inline void btree_print_ctx_free(BTreePrintCtx *ctx)
+{
+    free(ctx->arena);
+    free(ctx->label_pool);
+    free(ctx->line);
+    free((void *)ctx->walk_stack);
+    free(ctx->scratch);
+    btree_print_ctx_init(ctx);
+}
+
+/* 单调时钟, 纳秒, 只在统计耗时的时候用 */
+static inline unsigned long long _btree_print_now_ns(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#elif defined(TIME_UTC)
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#else
+    return (unsigned long long)clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#endif
+}
+
+/* 每个结点在arena里占的字节数, 8字节对齐的数组放前面, 这样每一段都是对齐的 */
+#define _BTREE_PRINT_NODE_BYTES (sizeof(const void *) + sizeof(size_t) + 7 * sizeof(int))
+
+/* ctx现在一共占了多少字节, 和mem_cap比较用 */
+static inline size_t _btree_print_mem(const BTreePrintCtx *ctx)
+{
+    return ctx->node_cap * _BTREE_PRINT_NODE_BYTES + ctx->label_cap + ctx->line_cap + ctx->walk_cap * sizeof(const void *) +
+           ctx->scratch_cap * sizeof(int);
+}
+
+/* 再申请size字节会不会超过mem_cap; realloc时新旧两块同时存在, 所以旧的那块也算进去 */
+static inline int _btree_print_over_cap(BTreePrintCtx *ctx, size_t size)
+{
+    if (ctx->mem_cap == 0 || _btree_print_mem(ctx) + size <= ctx->mem_cap)
+        return 0;
+    ctx->mem_over = 1;
+    return 1;
+}
+
+/* 保证buf至少能放need个元素, 容量按两倍增长; 返回新的地址, 失败返回NULL且原buf不变 */
+static inline void *_btree_print_grow(BTreePrintCtx *ctx, void *buf, size_t *cap, size_t need, size_t elem_size)
+{
+    size_t new_cap;
+    void *new_buf;
+
+    if (need <= *cap)
+        return buf;
+    new_cap = *cap > 0 ? *cap : 4096;
+    while (new_cap < need)
+        new_cap *= 2;
+    if (_btree_print_over_cap(ctx, new_cap * elem_size))
+        return NULL;
+    new_buf = realloc(buf, new_cap * elem_size);
+    if (new_buf == NULL)
+        return NULL;
+    ctx->alloc_count++;
+    *cap = new_cap;
+    return new_buf;
+}
+
+/* 把arena切成各个平行数组 */
+static inline void _btree_print_slice_arena(BTreePrintCtx *ctx, void *arena, size_t cap)
+{
+    char *cur = (char *)arena;
+    ctx->address = (const void **)cur;
+    cur += cap * sizeof(const void *);
+    ctx->label_off = (size_t *)cur;
+    cur += cap * sizeof(size_t);
+    ctx->str_len = (int *)cur;
+    ctx->depth = ctx->str_len + cap;
+    ctx->left_margin = ctx->depth + cap;
+    ctx->lchild = ctx->left_margin + cap;
+    ctx->rchild = ctx->lchild + cap;
+    ctx->index_stack = ctx->rchild + cap;
+    ctx->vert_index_arr = ctx->index_stack + cap;
+    ctx->arena = arena;
+    ctx->node_cap = cap;
+}
+
+/* 保证arena至少能放need个结点, 按两倍增长, 已有的结点信息原样搬过去; 成功返回0 */
+static inline int _btree_print_reserve_nodes(BTreePrintCtx *ctx, size_t need)
+{
+    BTreePrintCtx old = *ctx;
+    size_t cap = ctx->node_cap > 0 ? ctx->node_cap : 1024, n = (size_t)ctx->node_count;
+    void *arena;
+
+    if (need <= ctx->node_cap)
+        return 0;
+    while (cap < need)
+        cap *= 2;
+    if (_btree_print_over_cap(ctx, cap * _BTREE_PRINT_NODE_BYTES))
+        return -1;
+    arena = malloc(cap * _BTREE_PRINT_NODE_BYTES);
+    if (arena == NULL)
+        return -1;
+    ctx->alloc_count++;
+    _btree_print_slice_arena(ctx, arena, cap);
+    if (n > 0)
+    { /* 层序遍历途中扩容, 只有这几个字段已经填过 */
+        memcpy(ctx->address, old.address, n * sizeof(const void *));
+        memcpy(ctx->label_off, old.label_off, n * sizeof(size_t));
+        memcpy(ctx->str_len, old.str_len, n * sizeof(int));
+        memcpy(ctx->depth, old.depth, n * sizeof(int));
+        memcpy(ctx->lchild, old.lchild, n * sizeof(int));
+        memcpy(ctx->rchild, old.rchild, n * sizeof(int));
+    }
+    free(old.arena);
+    return 0;
+}
+
+/* 开始一次新的打印, 清空上次的结点和字符串, 缓冲区保留 */
+static inline void _btree_print_reset(BTreePrintCtx *ctx)
+{
+    ctx->node_count = 0;
+    ctx->label_len = 0;
+}
+
+/* 把新结点追加到结点信息表末尾, 返回它的下标, 内存不足返回-1 */
+static inline int _btree_print_push_info(BTreePrintCtx *ctx, const void *address, int depth)
+{
+    int i = ctx->node_count;
+    if ((size_t)i >= ctx->node_cap && _btree_print_reserve_nodes(ctx, (size_t)i + 1) < 0)
+        return -1;
+    ctx->address[i] = address;
+    ctx->depth[i] = depth;
+    ctx->lchild[i] = -1;
+    ctx->rchild[i] = -1;
+    return ctx->node_count++;
+}
+
+/**
+ * 存在数组里的堆(下标i的孩子是2i+1和2i+2), 层序序号就是数组下标, 不用队列, 顺序扫一遍就把结构填好了
+ * 只建结构, 元素由调用者按下标格式化; address没有用, 填NULL
+ * max_depth大于0时只取前max_depth + 1层, 也就是数组开头的一段, 最后那一层没有孩子, 由调用者折叠, 见_btree_print_heap_subtree
+ * @return 放进结点信息表的结点个数, -1内存不足
+ */
+static inline int _btree_print_fill_heap(BTreePrintCtx *ctx, int count, int max_depth)
+{
+    int i, depth = 1, level_end = 1, kept = count;
+
+    _btree_print_reset(ctx);
+    if (count <= 0)
+        return 0;
+    if (max_depth > 0 && max_depth < 30 && (1 << (max_depth + 1)) - 1 < count)
+        kept = (1 << (max_depth + 1)) - 1;
+    if (_btree_print_reserve_nodes(ctx, (size_t)kept) < 0)
+        return -1;
+    for (i = 0; i < kept; ++i)
+    {
+        if (i == level_end)
+        { /* 第depth层有2^(depth-1)个结点 */
+            depth++;
+            level_end = level_end < kept / 2 ? 2 * level_end + 1 : kept;
+        }
+        ctx->address[i] = NULL;
+        ctx->depth[i] = depth;
+        ctx->lchild[i] = i < kept / 2 ? 2 * i + 1 : -1; /* 这样比较不会溢出 */
+        ctx->rchild[i] = i < (kept - 1) / 2 ? 2 * i + 2 : -1;
+    }
+    ctx->node_count = kept;
+    return kept;
+}
+
+/* 堆里以i为根的子树有几个结点: 往下第k层是下标[(i+1)*2^k - 1, (i+2)*2^k - 2]这一段, 截到count为止, 一共O(log n)段 */
+static inline int _btree_print_heap_subtree(int i, int count)
+{
+    long long lo = i, hi = i, n = 0;
+    while (lo < count)
+    {
+        n += (hi < count ? hi : count - 1) - lo + 1;
+        lo = 2 * lo + 1;
+        hi = 2 * hi + 2;
+    }
+    return (int)n;
+}
+
+/**
+ * 把一个元素按elem_fmt格式化追加到label_pool末尾, 返回字符串长度(不含括号), 内存不足返回-1
+ * 先直接往剩余空间里写, 放不下才扩容重写一次, 所以一般每个元素只格式化一次
+ */
+static inline int _btree_print_vformat(BTreePrintCtx *ctx, const char *elem_fmt, va_list args)
+{
+    va_list args_copy;
+    size_t room = ctx->label_cap - ctx->label_len;
+    int len;
+
+    va_copy(args_copy, args);
+    len = vsnprintf(room > 0 ? ctx->label_pool + ctx->label_len : NULL, room, elem_fmt, args);
+    if (len >= 0 && (size_t)len >= room)
+    { /* 放不下, 扩容后再格式化一次 */
+        char *pool = (char *)_btree_print_grow(ctx, ctx->label_pool, &ctx->label_cap, ctx->label_len + (size_t)len + 1, 1);
+        if (pool == NULL)
+            len = -1;
+        else
+        {
+            ctx->label_pool = pool;
+            vsnprintf(pool + ctx->label_len, (size_t)len + 1, elem_fmt, args_copy);
+        }
+    }
+    va_end(args_copy);
+    if (len < 0)
+        return -1;
+    ctx->label_len += (size_t)len;
+    return len;
+}
+
+/* 格式化一个元素追加到ctx->label_pool末尾, 返回长度; 给多线程打印和外存打印用 */
+static inline int _btree_print_format(BTreePrintCtx *ctx, const char *elem_fmt, ...)
+{
+    va_list args;
+    int len;
+    va_start(args, elem_fmt);
+    len = _btree_print_vformat(ctx, elem_fmt, args);
+    va_end(args);
+    return len;
+}
+
+/**
+ * 把第index个结点的元素按elem_fmt格式化进label_pool, 顺便记下打印长度
+ * 元素类型不固定, 所以用可变参数, 调用时把p->data传进来即可
+ */
+static inline int _btree_print_put_label(BTreePrintCtx *ctx, int index, const char *elem_fmt, ...)
+{
+    va_list args;
+    size_t off = ctx->label_len;
+    int len;
+
+    va_start(args, elem_fmt);
+    len = _btree_print_vformat(ctx, elem_fmt, args);
+    va_end(args);
+    if (len < 0)
+        return -1;
+    ctx->label_off[index] = off;
+    ctx->str_len[index] = len + 2; /* 计算打印后的元素长度, 加上两个括号 */
+    return 0;
+}
+
+/**
+ * 摘要打印时, 超过最大深度的子树折叠成一个结点, 元素打印成这个格式, %d是子树的结点个数, 比如(...+4213)
+ * 宽度按字节算, 所以只能用单字节字符, "…"这种多字节字符会让这一行后面的内容错位
+ */
+#ifndef BTREE_PRINT_COLLAPSED_FMT
+#define BTREE_PRINT_COLLAPSED_FMT "...+%d"
+#endif
+
+/* 把下标为index的结点设为折叠结点, count是被折叠的子树的结点个数 */
+static inline int _btree_print_put_collapsed(BTreePrintCtx *ctx, int index, int count)
+{
+    return _btree_print_put_label(ctx, index, BTREE_PRINT_COLLAPSED_FMT, count);
+}
+
+/* 保证walk_stack至少能放need个指针 */
+static inline int _btree_print_reserve_walk(BTreePrintCtx *ctx, size_t need)
+{
+    const void **stack = (const void **)_btree_print_grow(ctx, (void *)ctx->walk_stack, &ctx->walk_cap, need, sizeof(const void *));
+    if (stack == NULL)
+        return -1;
+    ctx->walk_stack = stack;
+    return 0;
+}
+
+/* 中序遍历计算横坐标, 栈里直接放下标, 返回横坐标累计长度 */
+static inline int _btree_print_inorder(BTreePrintCtx *ctx)
+{
+    const int *lchild = ctx->lchild, *rchild = ctx->rchild, *str_len = ctx->str_len;
+    int *left_margin = ctx->left_margin, *index_stack = ctx->index_stack;
+    int top = -1, i = 0;
+    int horizontal_accumu_cache = 0; /* 横坐标累计长度 */
+    do
+    {
+        while (i != -1)
+        {
+            index_stack[++top] = i;
+            i = lchild[i];
+        }
+        i = index_stack[top--];
+        left_margin[i] = horizontal_accumu_cache;  /* 计算横坐标 */
+        horizontal_accumu_cache += str_len[i] - 1; /* 减一可以重叠一个括号,更紧凑一点点 */
+        i = rchild[i];
+    } while (!(i == -1 && top == -1));
+    return horizontal_accumu_cache;
+}
+
+/**
+ * 紧凑排版(Reingold-Tilford那一类的轮廓合并): 不再每个结点独占一段横坐标, 左右两棵子树只要同一行不重叠就往中间挤,
+ * 父结点放在两个孩子中点的正中间, 只有一个孩子时和中序排版的相对位置一样. 横线, 竖线的画法不变, 还是_btree_print_emit打印
+ *
+ * 每棵子树记录每一层最左和最右画到哪里(轮廓). 子树沿着较高的孩子连成一条条长链, 同一条链上的轮廓共用一段数组,
+ * 合并两棵子树时只需要改较矮那棵的层数那么多项, 所有结点加起来是O(n). 下标都是层序序号, 孩子的下标总比父亲大,
+ * 倒着扫一遍就是自底向上, 不用栈
+ * @return 画布宽度, -1内存不足
+ */
+static inline int _btree_print_tidy(BTreePrintCtx *ctx)
+{
+    const int n = ctx->node_count, gap = BTREE_PRINT_TIDY_GAP;
+    const int *lchild = ctx->lchild, *rchild = ctx->rchild, *str_len = ctx->str_len;
+    int *left_margin = ctx->left_margin;
+    int *height, *pos, *xf, *delta, *contour_l, *contour_r, *scratch;
+    int i, k, a, b, t, s, hs, d, v, ca, cb, next, min_l, max_r;
+
+    scratch = (int *)_btree_print_grow(ctx, ctx->scratch, &ctx->scratch_cap, (size_t)n * 6, sizeof(int));
+    if (scratch == NULL)
+        return -1;
+    ctx->scratch = scratch;
+    height = scratch;          /* 子树高度, 最后一步借来存链的坐标系偏移 */
+    pos = height + n;          /* 结点在轮廓数组里的位置, 较高的孩子紧挨在父亲前面 */
+    xf = pos + n;              /* 结点在自己那条链的坐标系里的横坐标 */
+    delta = xf + n;            /* 链头(较矮的孩子)的坐标系相对于父亲坐标系的偏移 */
+    contour_l = delta + n;     /* 以pos为下标, 这一层最左画到哪里 */
+    contour_r = contour_l + n; /* 这一层最右画到哪里(不含) */
+
+    for (i = n - 1; i >= 0; --i)
+    {
+        a = lchild[i] != -1 ? height[lchild[i]] : 0;
+        b = rchild[i] != -1 ? height[rchild[i]] : 0;
+        height[i] = (a > b ? a : b) + 1;
+    }
+
+    /* 分链: 一条链占一段连续的位置, 链头在最后, 往下每层往前一个 */
+    pos[0] = height[0] - 1;
+    next = height[0];
+    for (i = 0; i < n; ++i)
+    {
+        a = lchild[i];
+        b = rchild[i];
+        t = (b == -1 || (a != -1 && height[a] >= height[b])) ? a : b;
+        s = t == a ? b : a;
+        if (t != -1)
+            pos[t] = pos[i] - 1;
+        if (s != -1)
+        {
+            next += height[s];
+            pos[s] = next - 1;
+        }
+    }
+
+    /* 自底向上放结点, 合并轮廓 */
+    for (i = n - 1; i >= 0; --i)
+    {
+        a = lchild[i];
+        b = rchild[i];
+        v = pos[i];
+        if (a == -1 && b == -1)
+        {
+            xf[i] = 0;
+            contour_l[v] = 0;
+            contour_r[v] = str_len[i];
+        }
+        else if (b == -1)
+        { /* 只有左孩子: 左括号落在孩子的右括号上面, 和中序排版一样 */
+            xf[i] = xf[a] + str_len[a] - 1;
+            contour_l[v] = xf[a] + str_len[a] / 2;
+            contour_r[v] = xf[i] + str_len[i];
+        }
+        else if (a == -1)
+        { /* 只有右孩子: 右括号落在孩子的左括号上面 */
+            xf[i] = xf[b] - str_len[i] + 1;
+            contour_l[v] = xf[i];
+            contour_r[v] = xf[b] + str_len[b] / 2;
+        }
+        else
+        {
+            t = height[a] >= height[b] ? a : b;
+            s = t == a ? b : a;
+            hs = height[s];
+            /* 较矮的子树挪多少, 才能在两棵子树都有的每一层左右至少隔gap列 */
+            d = s == b ? contour_r[pos[a]] + gap - contour_l[pos[b]] : contour_l[pos[b]] - gap - contour_r[pos[a]];
+            for (k = 1; k < hs; ++k)
+            {
+                if (s == b && contour_r[pos[a] - k] + gap - contour_l[pos[b] - k] > d)
+                    d = contour_r[pos[a] - k] + gap - contour_l[pos[b] - k];
+                if (s == a && contour_l[pos[b] - k] - gap - contour_r[pos[a] - k] < d)
+                    d = contour_l[pos[b] - k] - gap - contour_r[pos[a] - k];
+            }
+            /* 两个孩子的中点之间还要放得下父亲, 两边至少各一个横线 */
+            ca = xf[a] + (s == a ? d : 0) + str_len[a] / 2;
+            cb = xf[b] + (s == b ? d : 0) + str_len[b] / 2;
+            if (cb - ca < str_len[i] + 2)
+            {
+                if (s == b)
+                {
+                    d += str_len[i] + 2 - (cb - ca);
+                    cb = ca + str_len[i] + 2;
+                }
+                else
+                {
+                    d -= str_len[i] + 2 - (cb - ca);
+                    ca = cb - str_len[i] - 2;
+                }
+            }
+            delta[s] = d;
+            xf[i] = ca + (cb - ca - str_len[i]) / 2;
+            /* 较矮那棵的轮廓换到父亲的坐标系, 覆盖到较高那棵同一层的那一边 */
+            for (k = 0; k < hs; ++k)
+            {
+                if (s == b)
+                    contour_r[pos[t] - k] = contour_r[pos[b] - k] + d;
+                else
+                    contour_l[pos[t] - k] = contour_l[pos[a] - k] + d;
+            }
+            contour_l[v] = ca;
+            contour_r[v] = cb;
+        }
+    }
+
+    /* 根所在的链的坐标系就是整棵树的坐标系, 最左边平移到0 */
+    min_l = contour_l[pos[0]];
+    max_r = contour_r[pos[0]];
+    for (k = 1; k < height[0]; ++k)
+    {
+        min_l = contour_l[pos[0] - k] < min_l ? contour_l[pos[0] - k] : min_l;
+        max_r = contour_r[pos[0] - k] > max_r ? contour_r[pos[0] - k] : max_r;
+    }
+
+    /* 自顶向下把各条链的坐标系累加起来, 得到真正的横坐标 */
+    height[0] = -min_l;
+    for (i = 0; i < n; ++i)
+    {
+        left_margin[i] = xf[i] + height[i];
+        if ((a = lchild[i]) != -1)
+            height[a] = height[i] + (pos[a] != pos[i] - 1 ? delta[a] : 0);
+        if ((b = rchild[i]) != -1)
+            height[b] = height[i] + (pos[b] != pos[i] - 1 ? delta[b] : 0);
+    }
+    return max_r - min_l;
+}
+
+/* 准备行缓冲区, 一行最长是横坐标累计长度加一个括号, 再加换行和snprintf的'\0' */
+static inline int _btree_print_reserve_line(BTreePrintCtx *ctx, int horizontal_accumu_cache)
+{
+    char *line = (char *)_btree_print_grow(ctx, ctx->line, &ctx->line_cap, (size_t)horizontal_accumu_cache + 3, 1);
+    if (line == NULL)
+        return -1;
+    ctx->line = line;
+    return 0;
+}
+
+/* 行缓冲区里从cursor一直填c到end(不含), 返回新的cursor */
+static inline int _btree_print_fill(char *line, int cursor, int end, char c)
+{
+    if (cursor < end)
+    {
+        memset(line + cursor, c, (size_t)(end - cursor));
+        cursor = end;
+    }
+    return cursor;
+}
+
+/* 拼好竖线那一行并写出, k是vert_index_arr最后一个下标 */
+static inline int _btree_print_vert_row(BTreePrintCtx *ctx, int k, char vert_conj_char, btree_print_sink_fn sink, void *user)
+{
+    char *line = ctx->line;
+    int cursor = 0, j;
+    for (j = 0; j <= k; ++j)
+    {
+        cursor = _btree_print_fill(line, cursor, ctx->vert_index_arr[j], ' ');
+        line[cursor++] = vert_conj_char;
+    }
+    line[cursor++] = '\n';
+    return sink(user, line, (size_t)cursor);
+}
+
+/* 层序遍历把ctx的结点信息表和label_pool填好之后调用: 按ctx->layout算横坐标, 准备好行缓冲区, 成功返回0 */
+static inline int _btree_print_layout(BTreePrintCtx *ctx)
+{
+    ctx->horizontal_accumu_cache = 0;
+    if (ctx->node_count == 0)
+        return 0;
+    if (ctx->layout == BTREE_PRINT_LAYOUT_TIDY)
+    {
+        if ((ctx->horizontal_accumu_cache = _btree_print_tidy(ctx)) < 0)
+            return -1;
+    }
+    else
+        ctx->horizontal_accumu_cache = _btree_print_inorder(ctx);
+    return _btree_print_reserve_line(ctx, ctx->horizontal_accumu_cache);
+}
+
+/**
+ * 横坐标算好之后逐行打印
+ * 这里只用下标和label_pool, 不再碰结点本身, 所以函数版本和宏版本共用
+ * @return 0成功, -1 sink返回失败
+ */
+static inline int _btree_print_emit(BTreePrintCtx *ctx, btree_print_sink_fn sink, void *user)
+{
+    const char horiz_conj_char = '_';    /* 连接横线 */
+    const char vert_conj_char = '|';     /* 竖线 */
+    const char left_bracket_char = '(';  /* 每个元素左边的小括号, 你也可以换成你喜欢的 */
+    const char right_bracket_char = ')'; /* 元素右边的小括号 */
+
+    if (ctx->node_count == 0)
+        return 0;
+
+    /* 接下来开始打印, 每一行先在ctx->line里拼好, 成段的空格和横线直接memset, 元素从label_pool直接拷贝, 整行一次写出 */
+    const int *str_len = ctx->str_len, *depth = ctx->depth, *left_margin = ctx->left_margin;
+    const int *lchild = ctx->lchild, *rchild = ctx->rchild;
+    const size_t *label_off = ctx->label_off;
+    const int node_count = ctx->node_count;
+    char *line = ctx->line;
+    int *vert_index_arr = ctx->vert_index_arr;
+    int horiz_left_start, horiz_right_end, cursor, i, j, k, cur_depth = 1, end_flag = 0;
+    i = 0;
+    while (i < node_count)
+    {
+        k = -1;
+        cursor = 0;
+        while (depth[i] == cur_depth)
+        {
+            /* 打印左边 */
+            j = lchild[i];
+            if (j != -1)
+            { /* 有左孩子说明有横线要打印 */
+                horiz_left_start = left_margin[j] + str_len[j] / 2;
+                vert_index_arr[++k] = horiz_left_start;
+                cursor = _btree_print_fill(line, cursor, horiz_left_start, ' ');
+                cursor = _btree_print_fill(line, cursor, left_margin[i], horiz_conj_char);
+            }
+            else
+            { /* 没有左孩子全打印空格即可 */
+                cursor = _btree_print_fill(line, cursor, left_margin[i], ' ');
+            }
+
+            /* 打印元素 */
+            line[cursor] = left_bracket_char;
+            memcpy(line + cursor + 1, ctx->label_pool + label_off[i], (size_t)(str_len[i] - 2));
+            cursor += str_len[i];
+            line[cursor - 1] = right_bracket_char;
+
+            /* 打印右边 */
+            j = rchild[i];
+            if (j != -1)
+            {
+                horiz_right_end = left_margin[j] + str_len[j] / 2;
+                vert_index_arr[++k] = horiz_right_end;
+                cursor = _btree_print_fill(line, cursor, horiz_right_end, horiz_conj_char);
+            } /* 右边没有else ,因为只考虑横线即可, 空白算到同层下一个元素左边 */
+
+            if (++i >= node_count)
+            {
+                end_flag = 1; /* 打印完最后一个元素, 下一行不需要竖线了,提前结束 */
+                break;
+            }
+        }
+        line[cursor++] = '\n';
+        if (sink(user, line, (size_t)cursor) != 0)
+            return -1;
+
+        /* 打印竖线 */
+        if (!end_flag && _btree_print_vert_row(ctx, k, vert_conj_char, sink, user) != 0)
+            return -1;
+        cur_depth++;
+    }
+    return 0;
+}
+
+/* 统计时把sink包一层, 顺便数字节数和行数, 不统计时不会用到 */
+typedef struct _btree_print_stats_sink
+{
+    btree_print_sink_fn sink;
+    void *user;
+    BTreePrintStats *stats;
+} _BTreePrintStatsSink;
+
+static inline int _btree_print_stats_sink_fn(void *user, const char *buf, size_t len)
+{
+    _BTreePrintStatsSink *wrap = (_BTreePrintStatsSink *)user;
+    wrap->stats->bytes_emitted += len;
+    wrap->stats->lines_emitted++; /* 每次调用sink正好是一行 */
+    return wrap->sink(wrap->user, buf, len);
+}
+
+/**
+ * 统计按次选择, 也可以在编译时整个去掉:
+ *      stats为NULL时_btree_print_render直接转到_btree_print_render_plain, 没有计时, sink也不包一层;
+ *      宏版本传的是字面的NULL, 函数版本内联之后也是常量, 这个判断在编译时就消掉了
+ *      include之前定义BTREE_PRINT_NO_STATS, 统计的代码一行都不编译, 传进来的stats只会被清零
+ */
+
+/* 层序遍历开始前调用; 开始时间和已有的申请次数先暂存在bfs_ns和allocations里, 结束时换成差值 */
+static inline void _btree_print_stats_begin(BTreePrintCtx *ctx, BTreePrintStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifndef BTREE_PRINT_NO_STATS
+    stats->allocations = ctx->alloc_count;
+    stats->bfs_ns = _btree_print_now_ns();
+#else
+    (void)ctx;
+#endif
+}
+
+/* 层序遍历之后的全部工作: 算横坐标, 然后逐行打印; 成功返回0 */
+static inline int _btree_print_render_plain(BTreePrintCtx *ctx, btree_print_sink_fn sink, void *user)
+{
+    if (_btree_print_layout(ctx) < 0)
+        return -1;
+    return _btree_print_emit(ctx, sink, user);
+}
+
+/* 同_btree_print_render_plain, stats不为NULL时顺便统计 */
+static inline int _btree_print_render(BTreePrintCtx *ctx, btree_print_sink_fn sink, void *user, BTreePrintStats *stats)
+{
+#ifdef BTREE_PRINT_NO_STATS
+    (void)stats;
+    return _btree_print_render_plain(ctx, sink, user);
+#else
+    _BTreePrintStatsSink wrap;
+    unsigned long long t;
+    int ret;
+
+    if (stats == NULL)
+        return _btree_print_render_plain(ctx, sink, user);
+    t = _btree_print_now_ns();
+    stats->bfs_ns = t - stats->bfs_ns;
+    if (_btree_print_layout(ctx) < 0)
+        return -1;
+    stats->inorder_ns = _btree_print_now_ns() - t;
+    wrap.sink = sink;
+    wrap.user = user;
+    wrap.stats = stats;
+    t = _btree_print_now_ns();
+    ret = _btree_print_emit(ctx, _btree_print_stats_sink_fn, &wrap);
+    stats->emit_ns = _btree_print_now_ns() - t;
+    stats->node_count = ctx->node_count;
+    stats->max_depth = ctx->node_count > 0 ? ctx->depth[ctx->node_count - 1] : 0;
+    stats->horizontal_accumu_cache = ctx->horizontal_accumu_cache;
+    stats->allocations = ctx->alloc_count - stats->allocations;
+    return ret;
+#endif
+}
+
+/****************************************************************
+ * 持久排版句柄, 给"动态打印"用
+ ****************************************************************/
+
+/**
+ * @brief 持久的排版句柄: 树每改一步就重新打印一次时, 不用每次都从头层序遍历加中序遍历
+ *
+ *        每个结点占一个槽位, 缓存自己的打印宽度str_len, 子树宽度(子树里所有结点的str_len-1之和),
+ *        子树高度和子树结点数. 横坐标不直接存, 打印时自顶向下推出来:
+ *        左孩子的起点 = 自己的起点, 自己的横坐标 = 起点 + 左子树宽度, 右孩子的起点 = 自己的横坐标 + str_len - 1,
+ *        和中序遍历累加出来的结果完全一样. 这样插入, 删除, 旋转之后只需要更新改动的结点和它们到根的路径,
+ *        右边那一大片结点的横坐标自然跟着平移, 不用一个个去改. 深度同理, 打印时自顶向下得到, 不缓存.
+ *
+ *        结点地址到槽位用开放寻址的哈希表查, 只在更新的时候用
+ * @example
+ *      BTreeLayout layout;
+ *      btree_layout_init(&layout);
+ *      btree_layout_build(&layout, t, "%d");
+ *      btree_layout_print(&layout, btree_print_sink_file, stdout);
+ *      // 在p下面插入一个结点之后
+ *      btree_layout_update(&layout, t, p);
+ *      btree_layout_print(&layout, btree_print_sink_file, stdout);
+ *      btree_layout_free(&layout);
+ */
+typedef struct btree_layout
+{
+    BTreePrintCtx ctx;    /* 打印时用的结点信息表和行缓冲区, 元素字符串也存在ctx.label_pool里 */
+    const void **address; /* 以下都按槽位下标, 空闲槽位的address为NULL */
+    size_t *label_off;
+    int *str_len;
+    int *lchild;
+    int *rchild;
+    int *parent;
+    int *subtree_width;
+    int *height;
+    int *count;
+    void *arena; /* 上面这些数组都在这一块里 */
+    size_t slot_cap;
+    int slot_used; /* 用到过的槽位数 */
+    int free_head; /* 空闲槽位链表, 借lchild串起来 */
+    int root;      /* 根结点的槽位, 空树为-1 */
+    const void **map_key; /* 结点地址 -> 槽位, 开放寻址, 线性探测, 负载不超过一半 */
+    int *map_val;
+    size_t map_cap;
+    size_t map_count;
+    int *stack; /* 同步时的工作栈, 打印时的层序队列 */
+    size_t stack_cap;
+    int *visited; /* 这次更新同步过的槽位, 倒着算一遍子树信息 */
+    size_t visited_cap;
+    int visited_count;
+    int *orphan; /* 这次更新被摘下来的槽位, 最后没挂回树上的就释放 */
+    size_t orphan_cap;
+    int orphan_count;
+    size_t live_label_bytes; /* 还在用的元素字符串总长, 垃圾太多时压缩label_pool */
+    const char *elem_fmt;
+} BTreeLayout;
+
+static inline void btree_layout_init(BTreeLayout *layout)
+{
+    memset(layout, 0, sizeof(*layout));
+    btree_print_ctx_init(&layout->ctx);
+    layout->free_head = -1;
+    layout->root = -1;
+}
+
+static inline void btree_layout_free(BTreeLayout *layout)
+{
+    btree_print_ctx_free(&layout->ctx);
+    free(layout->arena);
+    free((void *)layout->map_key);
+    free(layout->map_val);
+    free(layout->stack);
+    free(layout->visited);
+    free(layout->orphan);
+    btree_layout_init(layout);
+}
+
+/* 地址的哈希, 指针低几位通常是0, 先混一下 */
+static inline size_t _btree_layout_hash(const void *address, size_t mask)
+{
+    unsigned long long h = (unsigned long long)(uintptr_t)address;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & mask;
+}
+
+/* 查结点地址对应的槽位, 没有返回-1 */
+static inline int _btree_layout_map_get(const BTreeLayout *layout, const void *address)
+{
+    size_t mask = layout->map_cap - 1, i;
+    if (layout->map_cap == 0)
+        return -1;
+    for (i = _btree_layout_hash(address, mask); layout->map_key[i] != NULL; i = (i + 1) & mask)
+    {
+        if (layout->map_key[i] == address)
+            return layout->map_val[i];
+    }
+    return -1;
+}
+
+/* 插入一个新地址(调用者保证不存在), 放不下就两倍扩容重新散列 */
+static inline int _btree_layout_map_put(BTreeLayout *layout, const void *address, int slot)
+{
+    size_t mask, i;
+    if ((layout->map_count + 1) * 2 > layout->map_cap)
+    {
+        size_t old_cap = layout->map_cap, new_cap = old_cap > 0 ? old_cap * 2 : 1024, k;
+        const void **old_key = layout->map_key;
+        int *old_val = layout->map_val;
+        const void **new_key = (const void **)calloc(new_cap, sizeof(const void *));
+        int *new_val = (int *)malloc(new_cap * sizeof(int));
+        if (new_key == NULL || new_val == NULL)
+        {
+            free((void *)new_key);
+            free(new_val);
+            return -1;
+        }
+        layout->ctx.alloc_count += 2;
+        mask = new_cap - 1;
+        for (k = 0; k < old_cap; ++k)
+        {
+            if (old_key[k] == NULL)
+                continue;
+            for (i = _btree_layout_hash(old_key[k], mask); new_key[i] != NULL; i = (i + 1) & mask)
+                ;
+            new_key[i] = old_key[k];
+            new_val[i] = old_val[k];
+        }
+        free((void *)old_key);
+        free(old_val);
+        layout->map_key = new_key;
+        layout->map_val = new_val;
+        layout->map_cap = new_cap;
+    }
+    mask = layout->map_cap - 1;
+    for (i = _btree_layout_hash(address, mask); layout->map_key[i] != NULL; i = (i + 1) & mask)
+        ;
+    layout->map_key[i] = address;
+    layout->map_val[i] = slot;
+    layout->map_count++;
+    return 0;
+}
+
+/* 删除一个地址, 线性探测用后移删除, 不留墓碑 */
+static inline void _btree_layout_map_del(BTreeLayout *layout, const void *address)
+{
+    size_t mask = layout->map_cap - 1, i, j, k;
+    if (layout->map_cap == 0)
+        return;
+    for (i = _btree_layout_hash(address, mask); layout->map_key[i] != address; i = (i + 1) & mask)
+    {
+        if (layout->map_key[i] == NULL)
+            return;
+    }
+    for (j = (i + 1) & mask; layout->map_key[j] != NULL; j = (j + 1) & mask)
+    {
+        k = _btree_layout_hash(layout->map_key[j], mask);
+        /* k不在(i, j]这一段里, 说明j上的元素可以挪到空出来的i */
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            layout->map_key[i] = layout->map_key[j];
+            layout->map_val[i] = layout->map_val[j];
+            i = j;
+        }
+    }
+    layout->map_key[i] = NULL;
+    layout->map_count--;
+}
+
+/* 每个槽位在arena里占的字节数, 8字节对齐的数组放前面 */
+#define _BTREE_LAYOUT_SLOT_BYTES (sizeof(const void *) + sizeof(size_t) + 7 * sizeof(int))
+
+/* 保证arena至少有need个槽位, 按两倍增长, 已用的槽位原样搬过去; 成功返回0 */
+static inline int _btree_layout_reserve_slots(BTreeLayout *layout, size_t need)
+{
+    size_t cap = layout->slot_cap > 0 ? layout->slot_cap : 1024, n = (size_t)layout->slot_used;
+    char *cur;
+    void *arena;
+
+    if (need <= layout->slot_cap)
+        return 0;
+    while (cap < need)
+        cap *= 2;
+    arena = malloc(cap * _BTREE_LAYOUT_SLOT_BYTES);
+    if (arena == NULL)
+        return -1;
+    layout->ctx.alloc_count++;
+    cur = (char *)arena;
+#define _BTREE_LAYOUT_MOVE(FIELD, TYPE)                                 \
+    do                                                                  \
+    {                                                                   \
+        if (n > 0)                                                      \
+            memcpy(cur, (const void *)layout->FIELD, n * sizeof(TYPE)); \
+        layout->FIELD = (TYPE *)cur;                                    \
+        cur += cap * sizeof(TYPE);                                      \
+    } while (0)
+    _BTREE_LAYOUT_MOVE(address, const void *);
+    _BTREE_LAYOUT_MOVE(label_off, size_t);
+    _BTREE_LAYOUT_MOVE(str_len, int);
+    _BTREE_LAYOUT_MOVE(lchild, int);
+    _BTREE_LAYOUT_MOVE(rchild, int);
+    _BTREE_LAYOUT_MOVE(parent, int);
+    _BTREE_LAYOUT_MOVE(subtree_width, int);
+    _BTREE_LAYOUT_MOVE(height, int);
+    _BTREE_LAYOUT_MOVE(count, int);
+#undef _BTREE_LAYOUT_MOVE
+    free(layout->arena);
+    layout->arena = arena;
+    layout->slot_cap = cap;
+    return 0;
+}
+
+/* 往layout的某个int工作数组末尾追加一个值 */
+static inline int _btree_layout_push(BTreeLayout *layout, int **arr, size_t *cap, int *count, int value)
+{
+    int *p = (int *)_btree_print_grow(&layout->ctx, *arr, cap, (size_t)*count + 1, sizeof(int));
+    if (p == NULL)
+        return -1;
+    *arr = p;
+    p[(*count)++] = value;
+    return 0;
+}
+
+/* 给新结点分配一个槽位并登记到哈希表, 元素字符串由调用者接着设置; 内存不足返回-1 */
+static inline int _btree_layout_new_slot(BTreeLayout *layout, const void *address)
+{
+    int s = layout->free_head;
+    if (s >= 0)
+        layout->free_head = layout->lchild[s];
+    else
+    {
+        if (_btree_layout_reserve_slots(layout, (size_t)layout->slot_used + 1) < 0)
+            return -1;
+        s = layout->slot_used++;
+    }
+    if (_btree_layout_map_put(layout, address, s) < 0)
+    {
+        layout->lchild[s] = layout->free_head;
+        layout->free_head = s;
+        layout->address[s] = NULL;
+        return -1;
+    }
+    layout->address[s] = address;
+    layout->label_off[s] = 0;
+    layout->str_len[s] = 2;
+    layout->lchild[s] = layout->rchild[s] = layout->parent[s] = -1;
+    layout->subtree_width[s] = 1;
+    layout->height[s] = layout->count[s] = 1;
+    return s;
+}
+
+static inline void _btree_layout_free_slot(BTreeLayout *layout, int s)
+{
+    _btree_layout_map_del(layout, layout->address[s]);
+    layout->live_label_bytes -= (size_t)(layout->str_len[s] - 2);
+    layout->address[s] = NULL;
+    layout->lchild[s] = layout->free_head;
+    layout->free_head = s;
+}
+
+/* 重新格式化槽位s的元素, 旧的字符串留在label_pool里成为垃圾 */
+static inline int _btree_layout_set_label(BTreeLayout *layout, int s, const char *elem_fmt, ...)
+{
+    va_list args;
+    size_t off = layout->ctx.label_len;
+    int len;
+
+    va_start(args, elem_fmt);
+    len = _btree_print_vformat(&layout->ctx, elem_fmt, args);
+    va_end(args);
+    if (len < 0)
+        return -1;
+    layout->live_label_bytes -= (size_t)(layout->str_len[s] - 2);
+    layout->live_label_bytes += (size_t)len;
+    layout->label_off[s] = off;
+    layout->str_len[s] = len + 2;
+    return 0;
+}
+
+/* 由两个孩子重新算槽位s的子树宽度, 高度, 结点数 */
+static inline void _btree_layout_pull(BTreeLayout *layout, int s)
+{
+    int l = layout->lchild[s], r = layout->rchild[s];
+    int width = layout->str_len[s] - 1, height = 0, count = 1;
+    if (l >= 0)
+    {
+        width += layout->subtree_width[l];
+        height = layout->height[l];
+        count += layout->count[l];
+    }
+    if (r >= 0)
+    {
+        width += layout->subtree_width[r];
+        height = layout->height[r] > height ? layout->height[r] : height;
+        count += layout->count[r];
+    }
+    layout->subtree_width[s] = width;
+    layout->height[s] = height + 1;
+    layout->count[s] = count;
+}
+
+/* 开始一次更新 */
+static inline void _btree_layout_begin(BTreeLayout *layout)
+{
+    layout->visited_count = 0;
+    layout->orphan_count = 0;
+}
+
+/**
+ * 同步结束后调用: 倒着给同步过的槽位重算子树信息(同步是自顶向下的, 倒过来孩子一定在父亲之前),
+ * 再从from往上一路更新到根; 然后释放没挂回树上的槽位, 垃圾太多时压缩label_pool
+ */
+static inline int _btree_layout_finish(BTreeLayout *layout, int from)
+{
+    int i, s, c, top;
+
+    for (i = layout->visited_count - 1; i >= 0; --i)
+        _btree_layout_pull(layout, layout->visited[i]);
+    for (s = from >= 0 ? layout->parent[from] : -1; s >= 0; s = layout->parent[s])
+        _btree_layout_pull(layout, s);
+
+    /* 被摘下来又没挂到别处的子树整个释放, 它下面已经挂到别处的结点parent已经改了, 不会被误删 */
+    for (i = 0; i < layout->orphan_count; ++i)
+    {
+        s = layout->orphan[i];
+        if (layout->address[s] == NULL || layout->parent[s] >= 0 || s == layout->root)
+            continue;
+        top = 0;
+        if (_btree_layout_push(layout, &layout->stack, &layout->stack_cap, &top, s) < 0)
+            return -1;
+        while (top > 0)
+        {
+            s = layout->stack[--top];
+            c = layout->lchild[s];
+            if (c >= 0 && layout->parent[c] == s && layout->address[c] != NULL)
+            {
+                layout->parent[c] = -1;
+                if (_btree_layout_push(layout, &layout->stack, &layout->stack_cap, &top, c) < 0)
+                    return -1;
+            }
+            c = layout->rchild[s];
+            if (c >= 0 && layout->parent[c] == s && layout->address[c] != NULL)
+            {
+                layout->parent[c] = -1;
+                if (_btree_layout_push(layout, &layout->stack, &layout->stack_cap, &top, c) < 0)
+                    return -1;
+            }
+            _btree_layout_free_slot(layout, s);
+        }
+    }
+    layout->visited_count = layout->orphan_count = 0;
+
+    /* 改来改去label_pool里的垃圾超过一半时, 把还在用的字符串挪到一块新内存里 */
+    if (layout->ctx.label_len > 2 * layout->live_label_bytes + 4096)
+    {
+        size_t cap = 2 * layout->live_label_bytes + 4096, len = 0;
+        char *pool = (char *)malloc(cap);
+        if (pool == NULL)
+            return 0; /* 不压缩也能用 */
+        layout->ctx.alloc_count++;
+        for (s = 0; s < layout->slot_used; ++s)
+        {
+            if (layout->address[s] == NULL)
+                continue;
+            memcpy(pool + len, layout->ctx.label_pool + layout->label_off[s], (size_t)(layout->str_len[s] - 2));
+            layout->label_off[s] = len;
+            len += (size_t)(layout->str_len[s] - 2);
+        }
+        free(layout->ctx.label_pool);
+        layout->ctx.label_pool = pool;
+        layout->ctx.label_len = len;
+        layout->ctx.label_cap = cap;
+    }
+    return 0;
+}
+
+/* 清空句柄里的所有结点, 缓冲区保留 */
+static inline void _btree_layout_clear(BTreeLayout *layout)
+{
+    if (layout->map_cap > 0)
+        memset((void *)layout->map_key, 0, layout->map_cap * sizeof(const void *));
+    layout->map_count = 0;
+    layout->slot_used = 0;
+    layout->free_head = -1;
+    layout->root = -1;
+    layout->ctx.label_len = 0;
+    layout->live_label_bytes = 0;
+}
+
+/**
+ * 自顶向下把句柄里的树按层序展开成ctx的结点信息表, 横坐标由子树宽度推出, 和中序遍历的结果一样
+ * 之后直接交给_btree_print_emit逐行打印
+ */
+static inline int _btree_layout_fill_ctx(BTreeLayout *layout)
+{
+    BTreePrintCtx *ctx = &layout->ctx;
+    int n = layout->root >= 0 ? layout->count[layout->root] : 0;
+    int front, s, c, base;
+    int *queue;
+
+    ctx->node_count = 0;
+    ctx->horizontal_accumu_cache = 0;
+    if (n == 0)
+        return 0;
+    if (_btree_print_reserve_nodes(ctx, (size_t)n) < 0)
+        return -1;
+    queue = (int *)_btree_print_grow(ctx, layout->stack, &layout->stack_cap, (size_t)n, sizeof(int));
+    if (queue == NULL)
+        return -1;
+    layout->stack = queue;
+
+    _btree_print_push_info(ctx, layout->address[layout->root], 1);
+    queue[0] = layout->root;
+    ctx->left_margin[0] = 0; /* 入队时left_margin先放子树的起点, 出队时再换成横坐标 */
+    for (front = 0; front < ctx->node_count; ++front)
+    {
+        s = queue[front];
+        base = ctx->left_margin[front];
+        ctx->label_off[front] = layout->label_off[s];
+        ctx->str_len[front] = layout->str_len[s];
+        c = layout->lchild[s];
+        ctx->left_margin[front] = base + (c >= 0 ? layout->subtree_width[c] : 0);
+        if (c >= 0)
+        {
+            ctx->lchild[front] = _btree_print_push_info(ctx, layout->address[c], ctx->depth[front] + 1);
+            queue[ctx->lchild[front]] = c;
+            ctx->left_margin[ctx->lchild[front]] = base;
+        }
+        c = layout->rchild[s];
+        if (c >= 0)
+        {
+            ctx->rchild[front] = _btree_print_push_info(ctx, layout->address[c], ctx->depth[front] + 1);
+            queue[ctx->rchild[front]] = c;
+            ctx->left_margin[ctx->rchild[front]] = ctx->left_margin[front] + layout->str_len[s] - 1;
+        }
+    }
+    ctx->horizontal_accumu_cache = layout->subtree_width[layout->root];
+    return _btree_print_reserve_line(ctx, ctx->horizontal_accumu_cache);
+}
+
+/**
+ * @brief 打印句柄里当前的树, 输出和btree_visual_print对同一棵树的输出完全一样
+ *        不碰原来的树, 不格式化元素, 也不做中序遍历
+ * @return 0成功, -1内存不足或sink返回失败
+ */
+static inline int btree_layout_print(BTreeLayout *layout, btree_print_sink_fn sink, void *user)
+{
+    if (_btree_layout_fill_ctx(layout) < 0)
+        return -1;
+    return _btree_print_emit(&layout->ctx, sink, user);
+}
+
+/****************************************************************
+ * 视口打印, 只输出一块列范围和深度范围
+ ****************************************************************/
+
+/* 整棵树打印出来的宽度(列数), 翻页时用 */
+static inline int btree_layout_width(const BTreeLayout *layout)
+{
+    return layout->root >= 0 ? layout->subtree_width[layout->root] + 1 : 0;
+}
+
+/* 整棵树的层数, 也就是打印出来的结点行数 */
+static inline int btree_layout_height(const BTreeLayout *layout)
+{
+    return layout->root >= 0 ? layout->height[layout->root] : 0;
+}
+
+/* 起点为base的子树c, 它的根的中点, 也就是父亲的横线和竖线落下的那一列 */
+static inline int _btree_layout_center(const BTreeLayout *layout, int c, int base)
+{
+    int l = layout->lchild[c];
+    return base + (l >= 0 ? layout->subtree_width[l] : 0) + layout->str_len[c] / 2;
+}
+
+/* 同_btree_print_fill, 但cursor和end都是整棵树的列号, 只有落在[col_begin, col_end)里的部分写进line */
+static inline int _btree_print_fill_clip(char *line, int cursor, int end, char c, int col_begin, int col_end)
+{
+    int from = cursor > col_begin ? cursor : col_begin, to = end < col_end ? end : col_end;
+    if (from < to)
+        memset(line + (from - col_begin), c, (size_t)(to - from));
+    return cursor > end ? cursor : end;
+}
+
+/* 在第col列放一个字符, 不在视口里就不放 */
+static inline void _btree_print_put_clip(char *line, int col, char c, int col_begin, int col_end)
+{
+    if (col >= col_begin && col < col_end)
+        line[col - col_begin] = c;
+}
+
+/* [from, to)这一段画了非空白的东西, 它落在视口里的部分决定这一行裁剪后的长度 */
+static inline int _btree_print_ink_clip(int ink, int from, int to, int col_begin, int col_end)
+{
+    if (from < col_end && to > col_begin && to > ink)
+        ink = to < col_end ? to : col_end;
+    return ink;
+}
+
+/* 拼好的一行只输出到视口里最后一个非空白的字符, 和整棵树打印时行尾不留空格一致 */
+static inline int _btree_print_sink_clip(char *line, int ink, int col_begin, btree_print_sink_fn sink, void *user)
+{
+    int len = ink - col_begin;
+    line[len++] = '\n';
+    return sink(user, line, (size_t)len);
+}
+
+/**
+ * @brief 只打印[col_begin, col_end)这几列和[depth_begin, depth_end]这几层, 输出就是整棵树打印结果的对应切片
+ *        (每行视口之外的部分去掉, 行尾不补空格), 范围覆盖整棵树时和btree_layout_print一字不差
+ *
+ *        按层往下走, 子树所占的列是[起点, 起点 + 子树宽度], 和视口不相交的子树整个跳过, 比depth_end深的也不走,
+ *        所以代价只和视口里的内容加上树高有关, 和整棵树有多大无关, 左右翻页, 往下钻都很快
+ *
+ * @param col_begin 起始列, 从0开始
+ * @param col_end 结束列(不含), 传-1表示到最右边, 见btree_layout_width
+ * @param depth_begin 起始层, 根是第1层
+ * @param depth_end 结束层(含), 传-1表示到最深, 见btree_layout_height; 不是最后一层时, 下面那行竖线也会打出来
+ * @return 0成功, -1内存不足或sink返回失败
+ * @example
+ *      btree_layout_build(&layout, t, "%d");
+ *      // 第10000列开始的一屏, 从第5层往下看20层
+ *      btree_layout_print_view(&layout, 10000, 10000 + 200, 5, 5 + 19, btree_print_sink_file, stdout);
+ */
+static inline int btree_layout_print_view(BTreeLayout *layout, int col_begin, int col_end, int depth_begin, int depth_end,
+                                          btree_print_sink_fn sink, void *user)
+{
+    const char horiz_conj_char = '_', vert_conj_char = '|', left_bracket_char = '(', right_bracket_char = ')';
+    BTreePrintCtx *ctx = &layout->ctx;
+    int width = btree_layout_width(layout), height = btree_layout_height(layout);
+    int queued = 0, front = 0, level_end, d, i, s, c, x, base, cursor, ink, len, from, to;
+    char *line;
+
+    if (col_begin < 0)
+        col_begin = 0;
+    if (col_end < 0 || col_end > width)
+        col_end = width;
+    if (depth_begin < 1)
+        depth_begin = 1;
+    if (depth_end < 0 || depth_end > height)
+        depth_end = height;
+    if (col_begin >= col_end || depth_begin > depth_end)
+        return 0;
+    if (_btree_print_reserve_line(ctx, col_end - col_begin) < 0)
+        return -1;
+    line = ctx->line;
+
+    /* layout->stack是层序队列放槽位, ctx->left_margin放子树的起点, 出队时换成横坐标 */
+    ctx->node_count = 0;
+    if (_btree_print_push_info(ctx, layout->address[layout->root], 1) < 0 ||
+        _btree_layout_push(layout, &layout->stack, &layout->stack_cap, &queued, layout->root) < 0)
+        return -1;
+    ctx->left_margin[0] = 0;
+
+    for (d = 1; d <= depth_end; ++d)
+    {
+        level_end = ctx->node_count;
+        for (i = front; i < level_end; ++i)
+        {
+            s = layout->stack[i];
+            base = ctx->left_margin[i];
+            c = layout->lchild[s];
+            x = base + (c >= 0 ? layout->subtree_width[c] : 0);
+            ctx->left_margin[i] = x;
+            if (d == depth_end)
+                continue;
+            /* 孩子的子树和视口相交才入队 */
+            if (c >= 0 && base <= col_end - 1 && base + layout->subtree_width[c] >= col_begin)
+            {
+                if (_btree_print_push_info(ctx, layout->address[c], d + 1) < 0 ||
+                    _btree_layout_push(layout, &layout->stack, &layout->stack_cap, &queued, c) < 0)
+                    return -1;
+                ctx->left_margin[ctx->node_count - 1] = base;
+            }
+            c = layout->rchild[s];
+            base = x + layout->str_len[s] - 1;
+            if (c >= 0 && base <= col_end - 1 && base + layout->subtree_width[c] >= col_begin)
+            {
+                if (_btree_print_push_info(ctx, layout->address[c], d + 1) < 0 ||
+                    _btree_layout_push(layout, &layout->stack, &layout->stack_cap, &queued, c) < 0)
+                    return -1;
+                ctx->left_margin[ctx->node_count - 1] = base;
+            }
+        }
+        if (d < depth_begin)
+        {
+            front = level_end;
+            continue;
+        }
+
+        /* 结点行, 和_btree_print_emit一样从左往右拼, 只是每一段都裁到视口里 */
+        cursor = 0;
+        ink = col_begin;
+        for (i = front; i < level_end; ++i)
+        {
+            s = layout->stack[i];
+            x = ctx->left_margin[i];
+            len = layout->str_len[s];
+            c = layout->lchild[s];
+            if (c >= 0)
+            {
+                base = x - layout->subtree_width[c];
+                from = _btree_layout_center(layout, c, base);
+                cursor = _btree_print_fill_clip(line, cursor, from, ' ', col_begin, col_end);
+                cursor = _btree_print_fill_clip(line, cursor, x, horiz_conj_char, col_begin, col_end);
+                ink = _btree_print_ink_clip(ink, from, x, col_begin, col_end);
+            }
+            else
+                cursor = _btree_print_fill_clip(line, cursor, x, ' ', col_begin, col_end);
+
+            _btree_print_put_clip(line, x, left_bracket_char, col_begin, col_end);
+            from = x + 1 > col_begin ? x + 1 : col_begin;
+            to = x + len - 1 < col_end ? x + len - 1 : col_end;
+            if (from < to)
+                memcpy(line + (from - col_begin), ctx->label_pool + layout->label_off[s] + (from - x - 1), (size_t)(to - from));
+            _btree_print_put_clip(line, x + len - 1, right_bracket_char, col_begin, col_end);
+            ink = _btree_print_ink_clip(ink, x, x + len, col_begin, col_end);
+            cursor = x + len;
+
+            c = layout->rchild[s];
+            if (c >= 0)
+            {
+                to = _btree_layout_center(layout, c, x + len - 1);
+                cursor = _btree_print_fill_clip(line, cursor, to, horiz_conj_char, col_begin, col_end);
+                ink = _btree_print_ink_clip(ink, x + len, to, col_begin, col_end);
+            }
+        }
+        if (_btree_print_sink_clip(line, ink, col_begin, sink, user) != 0)
+            return -1;
+
+        /* 竖线行, 落在每个孩子的中点上, 孩子本身不在视口里也照样算得出来 */
+        if (d < height)
+        {
+            cursor = 0;
+            ink = col_begin;
+            for (i = front; i < level_end; ++i)
+            {
+                s = layout->stack[i];
+                x = ctx->left_margin[i];
+                c = layout->lchild[s];
+                if (c >= 0)
+                {
+                    cursor = _btree_print_fill_clip(line, cursor, _btree_layout_center(layout, c, x - layout->subtree_width[c]), ' ',
+                                                    col_begin, col_end);
+                    _btree_print_put_clip(line, cursor, vert_conj_char, col_begin, col_end);
+                    ink = _btree_print_ink_clip(ink, cursor, cursor + 1, col_begin, col_end);
+                    cursor++;
+                }
+                c = layout->rchild[s];
+                if (c >= 0)
+                {
+                    cursor = _btree_print_fill_clip(line, cursor, _btree_layout_center(layout, c, x + layout->str_len[s] - 1), ' ',
+                                                    col_begin, col_end);
+                    _btree_print_put_clip(line, cursor, vert_conj_char, col_begin, col_end);
+                    ink = _btree_print_ink_clip(ink, cursor, cursor + 1, col_begin, col_end);
+                    cursor++;
+                }
+            }
+            if (_btree_print_sink_clip(line, ink, col_begin, sink, user) != 0)
+                return -1;
+        }
+        front = level_end;
+    }
+    return 0;
+}
+
+/****************************************************************
+ * 排版快照: 把算好的结点信息表存成二进制文件, 以后直接拿文件打印, 不用再遍历树
+ ****************************************************************/
+
+/**
+ * 快照文件格式, 全部按本机字节序, 读的时候发现字节序或版本不对就拒绝:
+ *      文件头 BTreePrintSnapshotHeader, 64字节
+ *      int32_t level_start[height + 1]  第d层(从0数)的结点是层序下标[level_start[d], level_start[d + 1])
+ *      int32_t left_margin[node_count]  以下都按层序下标, 横坐标是整棵树里的列号
+ *      int32_t str_len[node_count]      含括号
+ *      int32_t lchild[node_count]       没有则为-1
+ *      int32_t rchild[node_count]
+ *      补齐到8字节
+ *      uint64_t label_off[node_count]   元素字符串在labels里的偏移
+ *      char labels[label_bytes]
+ * 所有数组都是定长的, mmap之后直接当数组用, 不用解析
+ */
+#define BTREE_PRINT_SNAPSHOT_MAGIC "BTVPSNAP"
+#define BTREE_PRINT_SNAPSHOT_VERSION 1
+#define _BTREE_PRINT_SNAPSHOT_BYTE_ORDER 0x01020304u
+
+typedef struct btree_print_snapshot_header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    int32_t node_count;
+    int32_t height;
+    int32_t width; /* 打印出来的宽度(列数) */
+    int32_t layout;
+    uint64_t label_bytes;
+    uint64_t file_size;
+    uint64_t reserved[2];
+} BTreePrintSnapshotHeader;
+
+/**
+ * @brief 打开的快照, 数组都直接指向文件内容; 打印时的行缓冲区在ctx里, 所以同一个快照不能同时在几个线程里打印
+ * @example
+ *      BTreePrintSnapshot snap;
+ *      if (btree_print_snapshot_open(&snap, "tree.snap") == 0)
+ *      {
+ *          btree_print_snapshot_print(&snap, btree_print_sink_file, stdout);
+ *          btree_print_snapshot_close(&snap);
+ *      }
+ */
+typedef struct btree_print_snapshot
+{
+    BTreePrintCtx ctx; /* 只用行缓冲区 */
+    const char *data;  /* 整个文件 */
+    size_t size;
+    int owner; /* data是怎么来的: 0调用者给的内存, 1 mmap, 2 malloc */
+    int node_count;
+    int height;
+    int width;
+    const int32_t *level_start;
+    const int32_t *left_margin;
+    const int32_t *str_len;
+    const int32_t *lchild;
+    const int32_t *rchild;
+    const uint64_t *label_off;
+    const char *labels;
+    uint64_t label_bytes;
+} BTreePrintSnapshot;
+
+/* 按8字节对齐后的长度 */
+static inline uint64_t _btree_print_snapshot_align(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t)7;
+}
+
+/* 快照里除文件头以外各段的总长, 写和读用同一套算法 */
+static inline uint64_t _btree_print_snapshot_size(int node_count, int height, uint64_t label_bytes)
+{
+    uint64_t ints = (uint64_t)height + 1 + 4 * (uint64_t)node_count;
+    return sizeof(BTreePrintSnapshotHeader) + _btree_print_snapshot_align(ints * sizeof(int32_t)) +
+           (uint64_t)node_count * sizeof(uint64_t) + label_bytes;
+}
+
+/**
+ * @brief 把ctx里算好的排版写成快照, 交给sink输出, sink见btree_print_sink_file, btree_print_sink_buf等
+ *        ctx必须是刚打印过的(函数版本, 宏版本, 多线程, 摘要打印都行), 或者用btree_visual_print_snapshot直接生成
+ *        BTreeLayout打印过整棵树之后, 传&layout.ctx也可以; 打印过视口之后不行
+ *
+ * @return 0成功, -1内存不足或sink返回失败
+ * @example
+ *      FILE *fp = fopen("tree.snap", "wb");
+ *      BTREE_VISUAL_PRINT_SINK(&ctx, BTree, t, lchild, rchild, data, "%d", btree_print_sink_file, stdout);
+ *      btree_print_snapshot_write(&ctx, btree_print_sink_file, fp);
+ *      fclose(fp);
+ */
+static inline int btree_print_snapshot_write(const BTreePrintCtx *ctx, btree_print_sink_fn sink, void *user)
+{
+    BTreePrintSnapshotHeader header;
+    const int n = ctx->node_count, height = n > 0 ? ctx->depth[n - 1] : 0;
+    uint64_t off[512];
+    int32_t start, pad = 0;
+    int i, d, k;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BTREE_PRINT_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byte_order = _BTREE_PRINT_SNAPSHOT_BYTE_ORDER;
+    header.version = BTREE_PRINT_SNAPSHOT_VERSION;
+    header.node_count = n;
+    header.height = height;
+    header.width = n > 0 ? ctx->horizontal_accumu_cache + 1 : 0;
+    header.layout = ctx->layout;
+    header.label_bytes = ctx->label_len;
+    header.file_size = _btree_print_snapshot_size(n, height, ctx->label_len);
+    if (sink(user, (const char *)&header, sizeof(header)) != 0)
+        return -1;
+
+    /* 每层的起点: 层序下标里深度变化的地方 */
+    for (i = 0, d = 0; d <= height; ++d)
+    {
+        while (i < n && ctx->depth[i] <= d)
+            i++;
+        start = i;
+        if (sink(user, (const char *)&start, sizeof(start)) != 0)
+            return -1;
+    }
+    if ((n > 0 && (sink(user, (const char *)ctx->left_margin, (size_t)n * sizeof(int)) != 0 ||
+                   sink(user, (const char *)ctx->str_len, (size_t)n * sizeof(int)) != 0 ||
+                   sink(user, (const char *)ctx->lchild, (size_t)n * sizeof(int)) != 0 ||
+                   sink(user, (const char *)ctx->rchild, (size_t)n * sizeof(int)) != 0)) ||
+        ((height + 1) % 2 != 0 && sink(user, (const char *)&pad, sizeof(pad)) != 0))
+        return -1;
+
+    /* size_t不一定是8字节, 分批转成uint64_t再写 */
+    for (i = 0; i < n; i += k)
+    {
+        for (k = 0; k < 512 && i + k < n; ++k)
+            off[k] = ctx->label_off[i + k];
+        if (sink(user, (const char *)off, (size_t)k * sizeof(uint64_t)) != 0)
+            return -1;
+    }
+    if (ctx->label_len > 0 && sink(user, ctx->label_pool, ctx->label_len) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 从内存里的快照打开, 不拷贝, data在关闭之前必须一直有效, 地址要8字节对齐
+ * @return 0成功, -1不是快照, 版本或字节序不对, 或者长度不够
+ */
+static inline int btree_print_snapshot_load(BTreePrintSnapshot *snap, const void *data, size_t size)
+{
+    BTreePrintSnapshotHeader header;
+    const char *cur = (const char *)data;
+    uint64_t ints;
+
+    memset(snap, 0, sizeof(*snap));
+    btree_print_ctx_init(&snap->ctx);
+    if (size < sizeof(header) || ((uintptr_t)data & 7) != 0)
+        return -1;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, BTREE_PRINT_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.byte_order != _BTREE_PRINT_SNAPSHOT_BYTE_ORDER || header.version != BTREE_PRINT_SNAPSHOT_VERSION ||
+        header.node_count < 0 || header.height < 0 || header.width < 0 || (header.node_count == 0) != (header.height == 0) ||
+        header.height > header.node_count || header.label_bytes > size ||
+        header.file_size != _btree_print_snapshot_size(header.node_count, header.height, header.label_bytes) || header.file_size > size)
+        return -1;
+
+    ints = (uint64_t)header.height + 1;
+    cur += sizeof(header);
+    snap->level_start = (const int32_t *)cur;
+    snap->left_margin = snap->level_start + ints;
+    snap->str_len = snap->left_margin + header.node_count;
+    snap->lchild = snap->str_len + header.node_count;
+    snap->rchild = snap->lchild + header.node_count;
+    cur += _btree_print_snapshot_align((ints + 4 * (uint64_t)header.node_count) * sizeof(int32_t));
+    snap->label_off = (const uint64_t *)cur;
+    snap->labels = cur + (size_t)header.node_count * sizeof(uint64_t);
+    snap->label_bytes = header.label_bytes;
+    snap->node_count = header.node_count;
+    snap->height = header.height;
+    snap->width = header.width;
+    snap->data = (const char *)data;
+    snap->size = size;
+    return 0;
+}
+
+/**
+ * @brief 打开快照文件, 能mmap就mmap, 打印时只读用到的那几页; 不支持mmap的平台整个读进内存
+ * @return 0成功, -1打不开, 内存不足或者不是快照文件
+ */
+static inline int btree_print_snapshot_open(BTreePrintSnapshot *snap, const char *path)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    memset(snap, 0, sizeof(*snap));
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    if (btree_print_snapshot_load(snap, data, (size_t)st.st_size) != 0)
+    {
+        munmap(data, (size_t)st.st_size);
+        return -1;
+    }
+    snap->owner = 1;
+    return 0;
+#else
+    FILE *fp = fopen(path, "rb");
+    char *data = NULL;
+    long size;
+
+    memset(snap, 0, sizeof(*snap));
+    if (fp == NULL)
+        return -1;
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+        (data = (char *)malloc((size_t)size)) == NULL || fread(data, 1, (size_t)size, fp) != (size_t)size ||
+        btree_print_snapshot_load(snap, data, (size_t)size) != 0)
+    {
+        free(data);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    snap->owner = 2;
+    return 0;
+#endif
+}
+
+static inline void btree_print_snapshot_close(BTreePrintSnapshot *snap)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (snap->owner == 1)
+        munmap((void *)snap->data, snap->size);
+#endif
+    if (snap->owner == 2)
+        free((void *)snap->data);
+    btree_print_ctx_free(&snap->ctx);
+    memset(snap, 0, sizeof(*snap));
+}
+
+/* 快照打印出来的宽度(列数)和层数, 翻页时用 */
+static inline int btree_print_snapshot_width(const BTreePrintSnapshot *snap)
+{
+    return snap->width;
+}
+
+static inline int btree_print_snapshot_height(const BTreePrintSnapshot *snap)
+{
+    return snap->height;
+}
+
+/* 快照里第i个结点的中点 */
+static inline int _btree_print_snapshot_center(const BTreePrintSnapshot *snap, int i)
+{
+    return snap->left_margin[i] + snap->str_len[i] / 2;
+}
+
+/* 横坐标和长度都在[0, width]里, 后面怎么加减都不会溢出 */
+static inline int _btree_print_snapshot_span_ok(const BTreePrintSnapshot *snap, int i)
+{
+    return snap->left_margin[i] >= 0 && snap->left_margin[i] <= snap->width && snap->str_len[i] >= 2 && snap->str_len[i] <= snap->width;
+}
+
+/* 文件可能是坏的, 用到的结点都检查一下, 保证不会读写出界 */
+static inline int _btree_print_snapshot_node_ok(const BTreePrintSnapshot *snap, int i)
+{
+    int l = snap->lchild[i], r = snap->rchild[i];
+    return _btree_print_snapshot_span_ok(snap, i) && snap->label_off[i] <= snap->label_bytes &&
+           (uint64_t)(snap->str_len[i] - 2) <= snap->label_bytes - snap->label_off[i] &&
+           (l == -1 || (l >= 0 && l < snap->node_count && _btree_print_snapshot_span_ok(snap, l))) &&
+           (r == -1 || (r >= 0 && r < snap->node_count && _btree_print_snapshot_span_ok(snap, r)));
+}
+
+/* 结点行里结点i画到的范围, 同_btree_print_extent_begin / _btree_print_extent_end */
+static inline int _btree_print_snapshot_extent_end(const BTreePrintSnapshot *snap, int i)
+{
+    int c = snap->rchild[i];
+    return c != -1 ? _btree_print_snapshot_center(snap, c) : snap->left_margin[i] + snap->str_len[i];
+}
+
+/**
+ * @brief 同btree_layout_print_view, 只打印快照的[col_begin, col_end)列和[depth_begin, depth_end]层, 范围覆盖整棵树时和原来的打印一字不差
+ *        每一层的结点按横坐标排好了, 二分找到视口里第一个结点, 所以代价只和视口里的内容加上层数有关, 文件里别的部分不会被读到
+ *
+ * @param col_end 传-1表示到最右边, 见btree_print_snapshot_width
+ * @param depth_end 传-1表示到最深, 见btree_print_snapshot_height
+ * @return 0成功, -1内存不足, sink返回失败或快照内容不对
+ */
+static inline int btree_print_snapshot_print_view(BTreePrintSnapshot *snap, int col_begin, int col_end, int depth_begin, int depth_end,
+                                                  btree_print_sink_fn sink, void *user)
+{
+    const char horiz_conj_char = '_', vert_conj_char = '|', left_bracket_char = '(', right_bracket_char = ')';
+    int d, lo, hi, mid, first, end, i, c, x, len, cursor, ink, from, to;
+    char *line;
+
+    if (col_begin < 0)
+        col_begin = 0;
+    if (col_end < 0 || col_end > snap->width)
+        col_end = snap->width;
+    if (depth_begin < 1)
+        depth_begin = 1;
+    if (depth_end < 0 || depth_end > snap->height)
+        depth_end = snap->height;
+    if (col_begin >= col_end || depth_begin > depth_end)
+        return 0;
+    if (_btree_print_reserve_line(&snap->ctx, col_end - col_begin) < 0)
+        return -1;
+    line = snap->ctx.line;
+
+    for (d = depth_begin; d <= depth_end; ++d)
+    {
+        first = snap->level_start[d - 1];
+        end = snap->level_start[d];
+        if (first < 0 || first > end || end > snap->node_count)
+            return -1;
+        lo = first;
+        hi = end;
+        while (lo < hi)
+        { /* 第一个画到的范围越过col_begin的结点, 竖线都落在这个范围里, 两种行可以共用 */
+            mid = lo + (hi - lo) / 2;
+            if (!_btree_print_snapshot_node_ok(snap, mid))
+                return -1;
+            if (_btree_print_snapshot_extent_end(snap, mid) + 1 > col_begin)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        first = lo;
+
+        /* 结点行 */
+        cursor = col_begin;
+        ink = col_begin;
+        for (i = first; i < end; ++i)
+        {
+            if (!_btree_print_snapshot_node_ok(snap, i))
+                return -1;
+            x = snap->left_margin[i];
+            len = snap->str_len[i];
+            if ((c = snap->lchild[i]) != -1)
+            {
+                from = _btree_print_snapshot_center(snap, c);
+                if (from >= col_end)
+                    break;
+                cursor = _btree_print_fill_clip(line, cursor, from, ' ', col_begin, col_end);
+                cursor = _btree_print_fill_clip(line, cursor, x, horiz_conj_char, col_begin, col_end);
+                ink = _btree_print_ink_clip(ink, from, x, col_begin, col_end);
+            }
+            else if (x >= col_end)
+                break;
+            else
+                cursor = _btree_print_fill_clip(line, cursor, x, ' ', col_begin, col_end);
+
+            _btree_print_put_clip(line, x, left_bracket_char, col_begin, col_end);
+            from = x + 1 > col_begin ? x + 1 : col_begin;
+            to = x + len - 1 < col_end ? x + len - 1 : col_end;
+            if (from < to)
+                memcpy(line + (from - col_begin), snap->labels + snap->label_off[i] + (from - x - 1), (size_t)(to - from));
+            _btree_print_put_clip(line, x + len - 1, right_bracket_char, col_begin, col_end);
+            ink = _btree_print_ink_clip(ink, x, x + len, col_begin, col_end);
+            cursor = cursor > x + len ? cursor : x + len;
+
+            if ((c = snap->rchild[i]) != -1)
+            {
+                to = _btree_print_snapshot_center(snap, c);
+                cursor = _btree_print_fill_clip(line, cursor, to, horiz_conj_char, col_begin, col_end);
+                ink = _btree_print_ink_clip(ink, x + len, to, col_begin, col_end);
+            }
+        }
+        if (_btree_print_sink_clip(line, ink, col_begin, sink, user) != 0)
+            return -1;
+
+        /* 竖线行, 落在每个孩子的中点上 */
+        if (d < snap->height)
+        {
+            cursor = col_begin;
+            ink = col_begin;
+            for (i = first; i < end; ++i)
+            {
+                if (!_btree_print_snapshot_node_ok(snap, i))
+                    return -1;
+                if ((c = snap->lchild[i]) != -1)
+                {
+                    if ((x = _btree_print_snapshot_center(snap, c)) >= col_end)
+                        break;
+                    cursor = _btree_print_fill_clip(line, cursor, x, ' ', col_begin, col_end);
+                    _btree_print_put_clip(line, x, vert_conj_char, col_begin, col_end);
+                    ink = _btree_print_ink_clip(ink, x, x + 1, col_begin, col_end);
+                    cursor = cursor > x + 1 ? cursor : x + 1;
+                }
+                else if (snap->left_margin[i] >= col_end)
+                    break;
+                if ((c = snap->rchild[i]) != -1)
+                {
+                    if ((x = _btree_print_snapshot_center(snap, c)) >= col_end)
+                        break;
+                    cursor = _btree_print_fill_clip(line, cursor, x, ' ', col_begin, col_end);
+                    _btree_print_put_clip(line, x, vert_conj_char, col_begin, col_end);
+                    ink = _btree_print_ink_clip(ink, x, x + 1, col_begin, col_end);
+                    cursor = cursor > x + 1 ? cursor : x + 1;
+                }
+            }
+            if (_btree_print_sink_clip(line, ink, col_begin, sink, user) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* 打印整个快照, 和生成快照时的打印结果一字不差 */
+static inline int btree_print_snapshot_print(BTreePrintSnapshot *snap, btree_print_sink_fn sink, void *user)
+{
+    return btree_print_snapshot_print_view(snap, 0, -1, 1, -1, sink, user);
+}
+
+/****************************************************************
+ * 外存打印: 内存有硬上限, 放不下的树把每个结点的记录写到临时文件里, 一层一层顺序读写
+ ****************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+
+/* 外存打印时每个临时文件读写缓冲区的最小字节数, 内存上限给得太小时也至少用这么大 */
+#ifndef BTREE_PRINT_SPILL_MIN_BUF
+#define BTREE_PRINT_SPILL_MIN_BUF 4096
+#endif
+
+/**
+ * 临时文件都按层序顺序读写, 同一个文件要在几个位置同时读时, 每个位置单独open一次, 各有各的文件偏移:
+ *      REC      每个结点一条_BTreePrintSpillRec, 层序
+ *      LABEL    元素字符串首尾相接, 层序
+ *      LEVEL    每一层的结点个数, int64_t
+ *      WIDTH    子树宽度, int64_t; 自底向上算, 所以是从最后一层开始一层一层写的
+ *      X        横坐标, int64_t, 层序
+ *      QUEUE0/1 层序遍历时轮流当这一层和下一层的队列, 放结点指针; 算横坐标时再拿来放每个结点的起点
+ * 横坐标和宽度用int64_t, 外存打印的树可以比int能表示的画布还宽
+ */
+enum
+{
+    _BTREE_PRINT_SPILL_REC,
+    _BTREE_PRINT_SPILL_REC_A,
+    _BTREE_PRINT_SPILL_REC_B,
+    _BTREE_PRINT_SPILL_LABEL,
+    _BTREE_PRINT_SPILL_LABEL_R,
+    _BTREE_PRINT_SPILL_LEVEL,
+    _BTREE_PRINT_SPILL_LEVEL_R,
+    _BTREE_PRINT_SPILL_WIDTH,
+    _BTREE_PRINT_SPILL_WIDTH_R,
+    _BTREE_PRINT_SPILL_X,
+    _BTREE_PRINT_SPILL_X_A,
+    _BTREE_PRINT_SPILL_X_B,
+    _BTREE_PRINT_SPILL_QUEUE0,
+    _BTREE_PRINT_SPILL_QUEUE1,
+    _BTREE_PRINT_SPILL_FILES
+};
+
+/* 一个结点在REC里的记录 */
+typedef struct _btree_print_spill_rec
+{
+    int32_t str_len; /* 加上括号的打印长度 */
+    int32_t kids;    /* 1有左孩子, 2有右孩子 */
+} _BTreePrintSpillRec;
+
+/* 带缓冲区的fd, 不用stdio是为了缓冲区由这里分配, 算得清占了多少内存; 一个流同一时间只读或只写, 换方向前先seek */
+typedef struct _btree_print_spill_stream
+{
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t pos; /* 写: 缓冲了多少字节; 读: 下一个没读的字节 */
+    size_t len; /* 读: 缓冲区里有多少字节 */
+    int writing;
+} _BTreePrintSpillStream;
+
+typedef struct _btree_print_spill
+{
+    _BTreePrintSpillStream file[_BTREE_PRINT_SPILL_FILES];
+    char *block;      /* 所有流的缓冲区和输出缓冲区, 一整块 */
+    size_t block_size;
+    char *out;        /* 输出缓冲区, 攒满了交给sink, 所以一行再长也不用整行放在内存里 */
+    size_t out_len;
+    size_t out_cap;
+    int64_t node_count;
+    int64_t height;
+    int cur;          /* 层序遍历: 正在读的队列, 0或1 */
+    int64_t remain;   /* 这一层还没出队的结点个数 */
+    int64_t next;     /* 下一层已经入队的结点个数 */
+} _BTreePrintSpill;
+
+/* 写的流把缓冲区写进文件 */
+static inline int _btree_print_spill_flush(_BTreePrintSpillStream *s)
+{
+    size_t off = 0;
+    while (s->writing && off < s->pos)
+    {
+        ssize_t n = write(s->fd, s->buf + off, s->pos - off);
+        if (n <= 0)
+            return -1;
+        off += (size_t)n;
+    }
+    s->pos = 0;
+    return 0;
+}
+
+/* 跳到文件的第off个字节, 之后可以读也可以写 */
+static inline int _btree_print_spill_seek(_BTreePrintSpillStream *s, int64_t off)
+{
+    if (_btree_print_spill_flush(s) < 0)
+        return -1;
+    s->writing = 0;
+    s->pos = s->len = 0;
+    return lseek(s->fd, (off_t)off, SEEK_SET) < 0 ? -1 : 0;
+}
+
+static inline int _btree_print_spill_write(_BTreePrintSpillStream *s, const void *data, size_t size)
+{
+    const char *src = (const char *)data;
+    size_t k;
+    s->writing = 1;
+    while (size > 0)
+    {
+        if (s->pos == s->cap && _btree_print_spill_flush(s) < 0)
+            return -1;
+        k = s->cap - s->pos < size ? s->cap - s->pos : size;
+        memcpy(s->buf + s->pos, src, k);
+        s->pos += k;
+        src += k;
+        size -= k;
+    }
+    return 0;
+}
+
+/* 读不满size个字节就是文件坏了或者被截断了, 返回-1 */
+static inline int _btree_print_spill_read(_BTreePrintSpillStream *s, void *data, size_t size)
+{
+    char *dst = (char *)data;
+    size_t k;
+    while (size > 0)
+    {
+        if (s->pos == s->len)
+        {
+            ssize_t n = read(s->fd, s->buf, s->cap);
+            if (n <= 0)
+                return -1;
+            s->pos = 0;
+            s->len = (size_t)n;
+        }
+        k = s->len - s->pos < size ? s->len - s->pos : size;
+        memcpy(dst, s->buf + s->pos, k);
+        s->pos += k;
+        dst += k;
+        size -= k;
+    }
+    return 0;
+}
+
+static inline void _btree_print_spill_close(_BTreePrintSpill *sp)
+{
+    int i;
+    for (i = 0; i < _BTREE_PRINT_SPILL_FILES; ++i)
+        if (sp->file[i].fd >= 0)
+            close(sp->file[i].fd);
+    free(sp->block);
+    memset(sp, 0, sizeof(*sp));
+}
+
+/**
+ * 在tmp_dir里用mkstemp建临时文件, 名字猜不到; 每个文件的几个句柄都打开后马上unlink, 进程怎么退出都不会留下垃圾
+ * 所有缓冲区一共大约mem_cap的一半, 剩下的一半留给格式化元素; 每个缓冲区至少BTREE_PRINT_SPILL_MIN_BUF字节
+ * @param tmp_dir 传NULL用环境变量TMPDIR, 没有就是/tmp
+ * @return 0成功, -1建不了文件, 路径太长或内存不足
+ */
+static inline int _btree_print_spill_open(_BTreePrintSpill *sp, const char *tmp_dir, size_t mem_cap)
+{
+    /* 1表示和前一个是同一个文件, 再open一次得到另一个读写位置 */
+    static const char again[_BTREE_PRINT_SPILL_FILES] = {0, 1, 1, 0, 1, 0, 1, 0, 1, 0, 1, 1, 0, 0};
+    size_t size = mem_cap / 2 / (_BTREE_PRINT_SPILL_FILES + 1) / 8 * 8;
+    size_t path_cap;
+    char *path;
+    int i, n, linked = 0;
+
+    memset(sp, 0, sizeof(*sp));
+    for (i = 0; i < _BTREE_PRINT_SPILL_FILES; ++i)
+        sp->file[i].fd = -1;
+    if (size < BTREE_PRINT_SPILL_MIN_BUF)
+        size = BTREE_PRINT_SPILL_MIN_BUF;
+    if (tmp_dir == NULL && (tmp_dir = getenv("TMPDIR")) == NULL)
+        tmp_dir = "/tmp";
+    sp->block_size = size * (_BTREE_PRINT_SPILL_FILES + 1);
+    sp->block = (char *)malloc(sp->block_size);
+    path_cap = strlen(tmp_dir) + sizeof("/btree_print_XXXXXX");
+    path = (char *)malloc(path_cap);
+    if (sp->block == NULL || path == NULL)
+        goto fail;
+    for (i = 0; i < _BTREE_PRINT_SPILL_FILES; ++i)
+    {
+        _BTreePrintSpillStream *s = &sp->file[i];
+        s->buf = sp->block + (size_t)i * size;
+        s->cap = size;
+        if (again[i])
+        {
+            if ((s->fd = open(path, O_RDWR)) < 0)
+                goto fail;
+            continue;
+        }
+        if (linked)
+            unlink(path);
+        linked = 0;
+        /* mkstemp每次都会改写XXXXXX, 所以每个文件都重新生成模板 */
+        n = snprintf(path, path_cap, "%s/btree_print_XXXXXX", tmp_dir);
+        if (n < 0 || (size_t)n >= path_cap || (s->fd = mkstemp(path)) < 0)
+            goto fail;
+        linked = 1;
+    }
+    unlink(path);
+    free(path);
+    sp->out = sp->block + (size_t)_BTREE_PRINT_SPILL_FILES * size;
+    sp->out_cap = size;
+    return 0;
+fail:
+    if (linked)
+        unlink(path);
+    free(path);
+    _btree_print_spill_close(sp);
+    return -1;
+}
+
+/* 开始层序遍历, 根先放进队列; root为NULL时什么都不放 */
+static inline int _btree_print_spill_begin(_BTreePrintSpill *sp, const void *root)
+{
+    sp->node_count = sp->height = sp->remain = sp->next = 0;
+    sp->cur = 1; /* 根放在QUEUE0里当"下一层", 第一次出队时换过去 */
+    if (root == NULL)
+        return 0;
+    sp->next = 1;
+    return _btree_print_spill_write(&sp->file[_BTREE_PRINT_SPILL_QUEUE0], &root, sizeof(root));
+}
+
+/**
+ * 取出下一个要处理的结点, 一层取完了就换到下一层, 顺便把这一层的结点个数写进LEVEL
+ * @return 1取到了, 0遍历完了, -1读写失败
+ */
+static inline int _btree_print_spill_pop(_BTreePrintSpill *sp, const void **address)
+{
+    _BTreePrintSpillStream *queue = sp->file + _BTREE_PRINT_SPILL_QUEUE0;
+    if (sp->remain == 0)
+    {
+        if (sp->next == 0)
+            return 0;
+        sp->cur ^= 1;
+        if (_btree_print_spill_seek(&queue[sp->cur], 0) < 0 || _btree_print_spill_seek(&queue[sp->cur ^ 1], 0) < 0 ||
+            _btree_print_spill_write(&sp->file[_BTREE_PRINT_SPILL_LEVEL], &sp->next, sizeof(sp->next)) < 0)
+            return -1;
+        sp->remain = sp->next;
+        sp->next = 0;
+        sp->height++;
+    }
+    sp->remain--;
+    return _btree_print_spill_read(&queue[sp->cur], (void *)address, sizeof(*address)) < 0 ? -1 : 1;
+}
+
+/* 记下刚出队的结点: 元素字符串label(len字节, 不含括号), 非空的孩子按先左后右入队 */
+static inline int _btree_print_spill_node(_BTreePrintSpill *sp, const char *label, int len, const void *lchild, const void *rchild)
+{
+    _BTreePrintSpillStream *next = &sp->file[_BTREE_PRINT_SPILL_QUEUE0 + (sp->cur ^ 1)];
+    _BTreePrintSpillRec rec;
+
+    rec.str_len = len + 2;
+    rec.kids = (lchild != NULL ? 1 : 0) | (rchild != NULL ? 2 : 0);
+    if (_btree_print_spill_write(&sp->file[_BTREE_PRINT_SPILL_REC], &rec, sizeof(rec)) < 0 ||
+        _btree_print_spill_write(&sp->file[_BTREE_PRINT_SPILL_LABEL], label, (size_t)len) < 0)
+        return -1;
+    if (lchild != NULL && _btree_print_spill_write(next, &lchild, sizeof(lchild)) < 0)
+        return -1;
+    if (rchild != NULL && _btree_print_spill_write(next, &rchild, sizeof(rchild)) < 0)
+        return -1;
+    sp->next += (lchild != NULL) + (rchild != NULL);
+    sp->node_count++;
+    return 0;
+}
+
+/* 第d层(从0开始)的结点个数 */
+static inline int _btree_print_spill_level(_BTreePrintSpill *sp, int64_t d, int64_t *count)
+{
+    _BTreePrintSpillStream *s = &sp->file[_BTREE_PRINT_SPILL_LEVEL_R];
+    return _btree_print_spill_seek(s, d * (int64_t)sizeof(int64_t)) < 0 ? -1 : _btree_print_spill_read(s, count, sizeof(*count));
+}
+
+/**
+ * 自底向上算子树宽度, 和中序遍历是一回事: 一个结点的横坐标等于它前面所有结点的(str_len - 1)之和,
+ * 所以 宽度 = 左子树宽度 + str_len - 1 + 右子树宽度, 横坐标 = 起点 + 左子树宽度
+ * 下一层的孩子在REC里是按父亲的顺序, 先左后右排的, 所以读这一层时顺着读下一层的宽度就能对上
+ */
+static inline int _btree_print_spill_width(_BTreePrintSpill *sp)
+{
+    _BTreePrintSpillStream *rec_r = &sp->file[_BTREE_PRINT_SPILL_REC_A], *width = &sp->file[_BTREE_PRINT_SPILL_WIDTH];
+    _BTreePrintSpillStream *width_r = &sp->file[_BTREE_PRINT_SPILL_WIDTH_R];
+    _BTreePrintSpillRec rec;
+    int64_t d, j, count, w, child = 0, pre = sp->node_count, child_seg = 0, seg;
+    int k;
+
+    for (d = sp->height - 1; d >= 0; --d)
+    {
+        if (_btree_print_spill_level(sp, d, &count) < 0)
+            return -1;
+        pre -= count;
+        seg = sp->node_count - pre - count; /* 这一层在WIDTH里的起点, 它后面的层都已经写在前面了 */
+        if (_btree_print_spill_seek(rec_r, pre * (int64_t)sizeof(rec)) < 0 ||
+            _btree_print_spill_seek(width_r, child_seg * (int64_t)sizeof(w)) < 0)
+            return -1;
+        for (j = 0; j < count; ++j)
+        {
+            if (_btree_print_spill_read(rec_r, &rec, sizeof(rec)) < 0)
+                return -1;
+            w = rec.str_len - 1;
+            for (k = 1; k <= 2; k <<= 1)
+            {
+                if ((rec.kids & k) && _btree_print_spill_read(width_r, &child, sizeof(child)) < 0)
+                    return -1;
+                w += (rec.kids & k) ? child : 0;
+            }
+            if (_btree_print_spill_write(width, &w, sizeof(w)) < 0)
+                return -1;
+        }
+        if (_btree_print_spill_flush(width) < 0)
+            return -1;
+        child_seg = seg;
+    }
+    return 0;
+}
+
+/* 自顶向下算横坐标写进X, 每个结点的起点放在QUEUE0/1里一层一层往下传 */
+static inline int _btree_print_spill_margin(_BTreePrintSpill *sp)
+{
+    _BTreePrintSpillStream *rec_r = &sp->file[_BTREE_PRINT_SPILL_REC_A], *width_r = &sp->file[_BTREE_PRINT_SPILL_WIDTH_R];
+    _BTreePrintSpillStream *x_w = &sp->file[_BTREE_PRINT_SPILL_X], *queue = sp->file + _BTREE_PRINT_SPILL_QUEUE0;
+    _BTreePrintSpillRec rec;
+    int64_t d, j, count, next_count, pre = 0, base = 0, w, x;
+    int cur = 0;
+
+    if (_btree_print_spill_seek(rec_r, 0) < 0 || _btree_print_spill_seek(x_w, 0) < 0 || _btree_print_spill_seek(&queue[0], 0) < 0 ||
+        _btree_print_spill_write(&queue[0], &base, sizeof(base)) < 0 || _btree_print_spill_level(sp, 0, &count) < 0)
+        return -1;
+    for (d = 0; d < sp->height; ++d)
+    {
+        next_count = 0;
+        if (d + 1 < sp->height && _btree_print_spill_read(&sp->file[_BTREE_PRINT_SPILL_LEVEL_R], &next_count, sizeof(next_count)) < 0)
+            return -1;
+        /* 下一层的宽度在WIDTH里紧挨在这一层前面 */
+        if (_btree_print_spill_seek(width_r, (sp->node_count - pre - count - next_count) * (int64_t)sizeof(w)) < 0 ||
+            _btree_print_spill_seek(&queue[cur], 0) < 0 || _btree_print_spill_seek(&queue[cur ^ 1], 0) < 0)
+            return -1;
+        for (j = 0; j < count; ++j)
+        {
+            if (_btree_print_spill_read(rec_r, &rec, sizeof(rec)) < 0 || _btree_print_spill_read(&queue[cur], &base, sizeof(base)) < 0)
+                return -1;
+            w = 0;
+            if ((rec.kids & 1) && (_btree_print_spill_read(width_r, &w, sizeof(w)) < 0 ||
+                                   _btree_print_spill_write(&queue[cur ^ 1], &base, sizeof(base)) < 0))
+                return -1;
+            x = base + w;
+            if (_btree_print_spill_write(x_w, &x, sizeof(x)) < 0)
+                return -1;
+            x += rec.str_len - 1; /* 右孩子的起点 */
+            if ((rec.kids & 2) && (_btree_print_spill_read(width_r, &w, sizeof(w)) < 0 ||
+                                   _btree_print_spill_write(&queue[cur ^ 1], &x, sizeof(x)) < 0))
+                return -1;
+        }
+        if (_btree_print_spill_flush(&queue[cur ^ 1]) < 0)
+            return -1;
+        pre += count;
+        count = next_count;
+        cur ^= 1;
+    }
+    return _btree_print_spill_flush(x_w);
+}
+
+/* 输出缓冲区满了就交给sink */
+static inline int _btree_print_spill_out(_BTreePrintSpill *sp, btree_print_sink_fn sink, void *user)
+{
+    if (sp->out_len > 0 && sink(user, sp->out, sp->out_len) != 0)
+        return -1;
+    sp->out_len = 0;
+    return 0;
+}
+
+/* 从cursor一直填c到end(不含), 和_btree_print_fill一样, 只是直接进输出缓冲区 */
+static inline int _btree_print_spill_fill(_BTreePrintSpill *sp, int64_t *cursor, int64_t end, char c, btree_print_sink_fn sink,
+                                          void *user)
+{
+    size_t k;
+    while (*cursor < end)
+    {
+        if (sp->out_len == sp->out_cap && _btree_print_spill_out(sp, sink, user) < 0)
+            return -1;
+        k = sp->out_cap - sp->out_len;
+        if ((int64_t)k > end - *cursor)
+            k = (size_t)(end - *cursor);
+        memset(sp->out + sp->out_len, c, k);
+        sp->out_len += k;
+        *cursor += (int64_t)k;
+    }
+    return 0;
+}
+
+static inline int _btree_print_spill_putc(_BTreePrintSpill *sp, char c, btree_print_sink_fn sink, void *user)
+{
+    if (sp->out_len == sp->out_cap && _btree_print_spill_out(sp, sink, user) < 0)
+        return -1;
+    sp->out[sp->out_len++] = c;
+    return 0;
+}
+
+/* 从LABEL里读len个字节的元素字符串直接放进输出缓冲区 */
+static inline int _btree_print_spill_label(_BTreePrintSpill *sp, size_t len, btree_print_sink_fn sink, void *user)
+{
+    size_t k;
+    while (len > 0)
+    {
+        if (sp->out_len == sp->out_cap && _btree_print_spill_out(sp, sink, user) < 0)
+            return -1;
+        k = sp->out_cap - sp->out_len < len ? sp->out_cap - sp->out_len : len;
+        if (_btree_print_spill_read(&sp->file[_BTREE_PRINT_SPILL_LABEL_R], sp->out + sp->out_len, k) < 0)
+            return -1;
+        sp->out_len += k;
+        len -= k;
+    }
+    return 0;
+}
+
+/* 下一个孩子的中心位置, 从REC_B和X_B顺着读 */
+static inline int _btree_print_spill_center(_BTreePrintSpill *sp, int64_t *center)
+{
+    _BTreePrintSpillRec rec;
+    int64_t x;
+    if (_btree_print_spill_read(&sp->file[_BTREE_PRINT_SPILL_REC_B], &rec, sizeof(rec)) < 0 ||
+        _btree_print_spill_read(&sp->file[_BTREE_PRINT_SPILL_X_B], &x, sizeof(x)) < 0)
+        return -1;
+    *center = x + rec.str_len / 2;
+    return 0;
+}
+
+/**
+ * 逐行输出, 每一行的画法和_btree_print_emit一样, 输出也一字不差
+ * REC_A, X_A, LABEL_R顺着读这一层, REC_B, X_B顺着读下一层找孩子的位置; 竖线那一行正好是下一层每个结点的中心,
+ * 所以把REC_B, X_B退回下一层开头再读一遍, 读完正好停在再下一层的开头
+ */
+static inline int _btree_print_spill_emit(_BTreePrintSpill *sp, btree_print_sink_fn sink, void *user)
+{
+    _BTreePrintSpillStream *rec_a = &sp->file[_BTREE_PRINT_SPILL_REC_A], *x_a = &sp->file[_BTREE_PRINT_SPILL_X_A];
+    _BTreePrintSpillStream *rec_b = &sp->file[_BTREE_PRINT_SPILL_REC_B], *x_b = &sp->file[_BTREE_PRINT_SPILL_X_B];
+    _BTreePrintSpillRec rec;
+    int64_t d, j, count, next_count, pre = 0, x, center, cursor;
+
+    if (_btree_print_spill_seek(rec_a, 0) < 0 || _btree_print_spill_seek(x_a, 0) < 0 ||
+        _btree_print_spill_seek(&sp->file[_BTREE_PRINT_SPILL_LABEL_R], 0) < 0 || _btree_print_spill_level(sp, 0, &count) < 0)
+        return -1;
+    sp->out_len = 0;
+    for (d = 0; d < sp->height; ++d)
+    {
+        next_count = 0;
+        if (d + 1 < sp->height && _btree_print_spill_read(&sp->file[_BTREE_PRINT_SPILL_LEVEL_R], &next_count, sizeof(next_count)) < 0)
+            return -1;
+        if (_btree_print_spill_seek(rec_b, (pre + count) * (int64_t)sizeof(rec)) < 0 ||
+            _btree_print_spill_seek(x_b, (pre + count) * (int64_t)sizeof(x)) < 0)
+            return -1;
+        cursor = 0;
+        for (j = 0; j < count; ++j)
+        {
+            if (_btree_print_spill_read(rec_a, &rec, sizeof(rec)) < 0 || _btree_print_spill_read(x_a, &x, sizeof(x)) < 0)
+                return -1;
+            if (rec.kids & 1)
+            {
+                if (_btree_print_spill_center(sp, &center) < 0 || _btree_print_spill_fill(sp, &cursor, center, ' ', sink, user) < 0 ||
+                    _btree_print_spill_fill(sp, &cursor, x, '_', sink, user) < 0)
+                    return -1;
+            }
+            else if (_btree_print_spill_fill(sp, &cursor, x, ' ', sink, user) < 0)
+                return -1;
+            if (_btree_print_spill_putc(sp, '(', sink, user) < 0 || _btree_print_spill_label(sp, (size_t)rec.str_len - 2, sink, user) < 0 ||
+                _btree_print_spill_putc(sp, ')', sink, user) < 0)
+                return -1;
+            cursor += rec.str_len;
+            if ((rec.kids & 2) &&
+                (_btree_print_spill_center(sp, &center) < 0 || _btree_print_spill_fill(sp, &cursor, center, '_', sink, user) < 0))
+                return -1;
+        }
+        if (_btree_print_spill_putc(sp, '\n', sink, user) < 0)
+            return -1;
+
+        /* 最后一层下面没有竖线 */
+        if (d + 1 < sp->height)
+        {
+            if (_btree_print_spill_seek(rec_b, (pre + count) * (int64_t)sizeof(rec)) < 0 ||
+                _btree_print_spill_seek(x_b, (pre + count) * (int64_t)sizeof(x)) < 0)
+                return -1;
+            cursor = 0;
+            for (j = 0; j < next_count; ++j)
+            {
+                if (_btree_print_spill_center(sp, &center) < 0 || _btree_print_spill_fill(sp, &cursor, center, ' ', sink, user) < 0 ||
+                    _btree_print_spill_putc(sp, '|', sink, user) < 0)
+                    return -1;
+                cursor++;
+            }
+            if (_btree_print_spill_putc(sp, '\n', sink, user) < 0)
+                return -1;
+        }
+        pre += count;
+        count = next_count;
+    }
+    return _btree_print_spill_out(sp, sink, user);
+}
+
+/* 层序遍历写完之后: 算宽度, 算横坐标, 逐行输出 */
+static inline int _btree_print_spill_render(_BTreePrintSpill *sp, btree_print_sink_fn sink, void *user)
+{
+    if (_btree_print_spill_flush(&sp->file[_BTREE_PRINT_SPILL_REC]) < 0 ||
+        _btree_print_spill_flush(&sp->file[_BTREE_PRINT_SPILL_LABEL]) < 0 ||
+        _btree_print_spill_flush(&sp->file[_BTREE_PRINT_SPILL_LEVEL]) < 0)
+        return -1;
+    if (sp->node_count == 0)
+        return 0;
+    if (_btree_print_spill_width(sp) < 0 || _btree_print_spill_margin(sp) < 0)
+        return -1;
+    return _btree_print_spill_emit(sp, sink, user);
+}
+#endif
+
+/****************************************************************
+ * 多线程打印, 需要在include之前定义BTREE_PRINT_PTHREAD, 编译时加-pthread
+ ****************************************************************/
+#ifdef BTREE_PRINT_PTHREAD
+#include <pthread.h>
+
+/* 并行逐行输出时每一段最多多少列, 一行比这长就切成几段分给不同的线程 */
+#ifndef BTREE_PRINT_PIECE_COLS
+#define BTREE_PRINT_PIECE_COLS (1 << 18)
+#endif
+
+/* 格式化一个元素, 追加到pool->label_pool末尾, 返回长度, -1内存不足; 由具体的结点类型提供 */
+typedef int (*_btree_print_label_fn)(BTreePrintCtx *pool, const void *address, const char *elem_fmt);
+
+struct _btree_print_pool;
+
+/* 每个线程自己的缓冲区, 线程之间不共享, 不用加锁 */
+typedef struct _btree_print_worker
+{
+    struct _btree_print_pool *pool;
+    int id;
+    pthread_t thread;
+    BTreePrintCtx scratch; /* 只用label_pool, 各线程先把元素格式化到这里, 最后拼到ctx->label_pool */
+    int *list;             /* 子树内部的层序队列 */
+    size_t list_cap;
+} _BTreePrintWorker;
+
+/* 并行输出时的一段: 第row行的[col_begin, col_end)列, 输出到round_buf + out_off */
+typedef struct _btree_print_piece
+{
+    int row;
+    int col_begin;
+    int col_end;
+    size_t out_off;
+} _BTreePrintPiece;
+
+/**
+ * 一个很小的线程池: 调用者自己算0号线程, 每一轮所有线程执行同一个函数, 从共享的任务计数器里领任务,
+ * 谁先做完谁多领, 子树大小不均匀时也能分得比较平均; 一轮结束调用者才返回(fork-join)
+ */
+typedef struct _btree_print_pool
+{
+    _BTreePrintWorker *workers;
+    int nthreads;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    unsigned generation;
+    int running;
+    int quit;
+    void (*fn)(struct _btree_print_pool *pool, _BTreePrintWorker *worker);
+    int next_task;
+    int task_count;
+    int failed;
+    /* 各阶段的参数 */
+    BTreePrintCtx *ctx;
+    _btree_print_label_fn label_fn;
+    const char *elem_fmt;
+    int *chunk_owner;  /* 格式化元素时每一块由哪个线程做的 */
+    size_t *pool_base; /* 每个线程的元素字符串拼到ctx->label_pool的哪里 */
+    int frontier;      /* 从这个下标开始的一层, 每个结点的子树是一个任务 */
+    int *level_start;  /* 每一层第一个结点的下标, 多一个哨兵 */
+    int *row_end;      /* 每一行(结点行和竖线行交替)的长度, 不含换行 */
+    _BTreePrintPiece *pieces;
+    char *round_buf;
+} _BTreePrintPool;
+
+/* 领一个任务, 没有了返回-1 */
+static inline int _btree_print_pool_next(_BTreePrintPool *pool)
+{
+    int task = -1;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->next_task < pool->task_count && !pool->failed)
+        task = pool->next_task++;
+    pthread_mutex_unlock(&pool->mutex);
+    return task;
+}
+
+static inline void _btree_print_pool_fail(_BTreePrintPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->failed = 1;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static inline void *_btree_print_pool_main(void *arg)
+{
+    _BTreePrintWorker *worker = (_BTreePrintWorker *)arg;
+    _BTreePrintPool *pool = worker->pool;
+    unsigned seen = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == seen && !pool->quit)
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        if (pool->quit)
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->fn(pool, worker);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done_cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/* 所有线程一起跑fn, task_count个任务分完, 都结束后返回; 返回0成功, -1有任务失败 */
+static inline int _btree_print_pool_run(_BTreePrintPool *pool, void (*fn)(_BTreePrintPool *, _BTreePrintWorker *), int task_count)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->next_task = 0;
+    pool->task_count = task_count;
+    pool->running = pool->nthreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    fn(pool, &pool->workers[0]);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+    return pool->failed ? -1 : 0;
+}
+
+/* 启动nthreads - 1个线程, 起不来的就少用几个; 返回0成功, -1内存不足 */
+static inline int _btree_print_pool_init(_BTreePrintPool *pool, int nthreads)
+{
+    int i;
+    memset(pool, 0, sizeof(*pool));
+    pool->workers = (_BTreePrintWorker *)calloc((size_t)nthreads, sizeof(_BTreePrintWorker));
+    if (pool->workers == NULL)
+        return -1;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->nthreads = 1;
+    for (i = 0; i < nthreads; ++i)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        btree_print_ctx_init(&pool->workers[i].scratch);
+    }
+    for (i = 1; i < nthreads; ++i)
+    {
+        if (pthread_create(&pool->workers[i].thread, NULL, _btree_print_pool_main, &pool->workers[i]) != 0)
+            break;
+        pool->nthreads++;
+    }
+    return 0;
+}
+
+static inline void _btree_print_pool_free(_BTreePrintPool *pool)
+{
+    int i;
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i = 1; i < pool->nthreads; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (i = 0; i < pool->nthreads; ++i)
+    {
+        btree_print_ctx_free(&pool->workers[i].scratch);
+        free(pool->workers[i].list);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->workers);
+    free(pool->chunk_owner);
+    free(pool->pool_base);
+    free(pool->level_start);
+    free(pool->row_end);
+    free(pool->pieces);
+    free(pool->round_buf);
+}
+
+/* 格式化元素时每个任务的结点个数 */
+#define _BTREE_PRINT_LABEL_CHUNK 4096
+
+/* 第一步: 各线程把自己领到的结点格式化进自己的scratch, label_off先记成在scratch里的偏移 */
+static inline void _btree_print_par_label(_BTreePrintPool *pool, _BTreePrintWorker *worker)
+{
+    BTreePrintCtx *ctx = pool->ctx;
+    int task, i, end, len;
+    while ((task = _btree_print_pool_next(pool)) >= 0)
+    {
+        pool->chunk_owner[task] = worker->id;
+        end = (task + 1) * _BTREE_PRINT_LABEL_CHUNK < ctx->node_count ? (task + 1) * _BTREE_PRINT_LABEL_CHUNK : ctx->node_count;
+        for (i = task * _BTREE_PRINT_LABEL_CHUNK; i < end; ++i)
+        {
+            if ((len = pool->label_fn(&worker->scratch, ctx->address[i], pool->elem_fmt)) < 0)
+            {
+                _btree_print_pool_fail(pool);
+                return;
+            }
+            ctx->label_off[i] = worker->scratch.label_len - (size_t)len;
+            ctx->str_len[i] = len + 2;
+        }
+    }
+}
+
+/* 第二步: 各线程把自己的scratch拷进ctx->label_pool, 再把每一块的label_off加上所属线程的起点 */
+static inline void _btree_print_par_label_merge(_BTreePrintPool *pool, _BTreePrintWorker *worker)
+{
+    BTreePrintCtx *ctx = pool->ctx;
+    int task, i, end;
+    size_t base;
+    if (worker->scratch.label_len > 0)
+        memcpy(ctx->label_pool + pool->pool_base[worker->id], worker->scratch.label_pool, worker->scratch.label_len);
+    while ((task = _btree_print_pool_next(pool)) >= 0)
+    {
+        base = pool->pool_base[pool->chunk_owner[task]];
+        end = (task + 1) * _BTREE_PRINT_LABEL_CHUNK < ctx->node_count ? (task + 1) * _BTREE_PRINT_LABEL_CHUNK : ctx->node_count;
+        for (i = task * _BTREE_PRINT_LABEL_CHUNK; i < end; ++i)
+            ctx->label_off[i] += base;
+    }
+}
+
+/* 子树root内部按层序排进worker->list, 父亲总在孩子前面; 返回结点个数, -1内存不足 */
+static inline int _btree_print_par_subtree(const BTreePrintCtx *ctx, _BTreePrintWorker *worker, int root)
+{
+    int n = 1, q, c;
+    int *list = (int *)_btree_print_grow(&worker->scratch, worker->list, &worker->list_cap, 1, sizeof(int));
+    if (list == NULL)
+        return -1;
+    worker->list = list;
+    list[0] = root;
+    for (q = 0; q < n; ++q)
+    {
+        if ((size_t)n + 2 > worker->list_cap)
+        {
+            if ((list = (int *)_btree_print_grow(&worker->scratch, worker->list, &worker->list_cap, (size_t)n + 2, sizeof(int))) == NULL)
+                return -1;
+            worker->list = list;
+        }
+        if ((c = ctx->lchild[list[q]]) != -1)
+            list[n++] = c;
+        if ((c = ctx->rchild[list[q]]) != -1)
+            list[n++] = c;
+    }
+    return n;
+}
+
+/* 第三步: frontier这一层每个结点的子树宽度(子树里所有str_len - 1之和), 借ctx->vert_index_arr存, 孩子先算 */
+static inline void _btree_print_par_width(_BTreePrintPool *pool, _BTreePrintWorker *worker)
+{
+    BTreePrintCtx *ctx = pool->ctx;
+    int *width = ctx->vert_index_arr;
+    int task, n, k, i;
+    while ((task = _btree_print_pool_next(pool)) >= 0)
+    {
+        if ((n = _btree_print_par_subtree(ctx, worker, pool->frontier + task)) < 0)
+        {
+            _btree_print_pool_fail(pool);
+            return;
+        }
+        for (k = n - 1; k >= 0; --k)
+        {
+            i = worker->list[k];
+            width[i] = ctx->str_len[i] - 1 + (ctx->lchild[i] != -1 ? width[ctx->lchild[i]] : 0) +
+                       (ctx->rchild[i] != -1 ? width[ctx->rchild[i]] : 0);
+        }
+    }
+}
+
+/* 第五步: 子树的起点已经在left_margin里, 自顶向下换成横坐标, 和中序遍历累加的结果一样 */
+static inline void _btree_print_par_margin(_BTreePrintPool *pool, _BTreePrintWorker *worker)
+{
+    BTreePrintCtx *ctx = pool->ctx;
+    const int *width = ctx->vert_index_arr;
+    int task, n, k, i, base, x;
+    while ((task = _btree_print_pool_next(pool)) >= 0)
+    {
+        if ((n = _btree_print_par_subtree(ctx, worker, pool->frontier + task)) < 0)
+        {
+            _btree_print_pool_fail(pool);
+            return;
+        }
+        for (k = 0; k < n; ++k)
+        {
+            i = worker->list[k];
+            base = ctx->left_margin[i];
+            x = base + (ctx->lchild[i] != -1 ? width[ctx->lchild[i]] : 0);
+            ctx->left_margin[i] = x;
+            if (ctx->lchild[i] != -1)
+                ctx->left_margin[ctx->lchild[i]] = base;
+            if (ctx->rchild[i] != -1)
+                ctx->left_margin[ctx->rchild[i]] = x + ctx->str_len[i] - 1;
+        }
+    }
+}
+
+/* 结点行里结点i画到的范围: 左边从左孩子的中点(或自己)开始, 右边到右孩子的中点(或自己的右括号)为止 */
+static inline int _btree_print_extent_begin(const BTreePrintCtx *ctx, int i)
+{
+    int c = ctx->lchild[i];
+    return c != -1 ? ctx->left_margin[c] + ctx->str_len[c] / 2 : ctx->left_margin[i];
+}
+
+static inline int _btree_print_extent_end(const BTreePrintCtx *ctx, int i)
+{
+    int c = ctx->rchild[i];
+    return c != -1 ? ctx->left_margin[c] + ctx->str_len[c] / 2 : ctx->left_margin[i] + ctx->str_len[i];
+}
+
+/**
+ * 输出第row行的[col_begin, col_end)列到out, 和_btree_print_emit拼出来的那一行对应的部分一模一样;
+ * 这一段是行尾时再补一个换行. 同一层的结点画到的范围互不重叠且从左往右, 二分找到第一个够得着的结点
+ */
+static inline void _btree_print_par_piece(const _BTreePrintPool *pool, const _BTreePrintPiece *piece)
+{
+    const char horiz_conj_char = '_', vert_conj_char = '|', left_bracket_char = '(', right_bracket_char = ')';
+    const BTreePrintCtx *ctx = pool->ctx;
+    const int level = piece->row / 2, col_begin = piece->col_begin, col_end = piece->col_end;
+    int lo = pool->level_start[level], hi = pool->level_start[level + 1], end = hi, mid, i, c, x, len, cursor, from, to;
+    char *line = pool->round_buf + piece->out_off;
+
+    while (lo < hi)
+    { /* 第一个画到的范围越过col_begin的结点, 竖线都落在这个范围里, 两种行可以共用 */
+        mid = lo + (hi - lo) / 2;
+        if (_btree_print_extent_end(ctx, mid) + 1 > col_begin)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    cursor = col_begin;
+    for (i = lo; i < end && _btree_print_extent_begin(ctx, i) < col_end; ++i)
+    {
+        x = ctx->left_margin[i];
+        if (piece->row % 2 == 0)
+        {
+            len = ctx->str_len[i];
+            if ((c = ctx->lchild[i]) != -1)
+            {
+                cursor = _btree_print_fill_clip(line, cursor, ctx->left_margin[c] + ctx->str_len[c] / 2, ' ', col_begin, col_end);
+                cursor = _btree_print_fill_clip(line, cursor, x, horiz_conj_char, col_begin, col_end);
+            }
+            else
+                cursor = _btree_print_fill_clip(line, cursor, x, ' ', col_begin, col_end);
+            _btree_print_put_clip(line, x, left_bracket_char, col_begin, col_end);
+            from = x + 1 > col_begin ? x + 1 : col_begin;
+            to = x + len - 1 < col_end ? x + len - 1 : col_end;
+            if (from < to)
+                memcpy(line + (from - col_begin), ctx->label_pool + ctx->label_off[i] + (from - x - 1), (size_t)(to - from));
+            _btree_print_put_clip(line, x + len - 1, right_bracket_char, col_begin, col_end);
+            cursor = cursor > x + len ? cursor : x + len;
+            if ((c = ctx->rchild[i]) != -1)
+                cursor = _btree_print_fill_clip(line, cursor, ctx->left_margin[c] + ctx->str_len[c] / 2, horiz_conj_char, col_begin,
+                                                col_end);
+        }
+        else
+        {
+            if ((c = ctx->lchild[i]) != -1)
+            {
+                cursor = _btree_print_fill_clip(line, cursor, ctx->left_margin[c] + ctx->str_len[c] / 2, ' ', col_begin, col_end);
+                _btree_print_put_clip(line, ctx->left_margin[c] + ctx->str_len[c] / 2, vert_conj_char, col_begin, col_end);
+                cursor = cursor > ctx->left_margin[c] + ctx->str_len[c] / 2 + 1 ? cursor : ctx->left_margin[c] + ctx->str_len[c] / 2 + 1;
+            }
+            if ((c = ctx->rchild[i]) != -1)
+            {
+                cursor = _btree_print_fill_clip(line, cursor, ctx->left_margin[c] + ctx->str_len[c] / 2, ' ', col_begin, col_end);
+                _btree_print_put_clip(line, ctx->left_margin[c] + ctx->str_len[c] / 2, vert_conj_char, col_begin, col_end);
+                cursor = cursor > ctx->left_margin[c] + ctx->str_len[c] / 2 + 1 ? cursor : ctx->left_margin[c] + ctx->str_len[c] / 2 + 1;
+            }
+        }
+    }
+    _btree_print_fill_clip(line, cursor, col_end, ' ', col_begin, col_end); /* 这一段最后一个结点之后的空白 */
+    if (col_end == pool->row_end[piece->row])
+        line[col_end - col_begin] = '\n';
+}
+
+/* 第六步: 各线程领几段, 拼到round_buf里各自的位置 */
+static inline void _btree_print_par_rows(_BTreePrintPool *pool, _BTreePrintWorker *worker)
+{
+    int task;
+    (void)worker;
+    while ((task = _btree_print_pool_next(pool)) >= 0)
+        _btree_print_par_piece(pool, &pool->pieces[task]);
+}
+
+/* 一轮最多这么多段 */
+#define _BTREE_PRINT_ROUND_PIECES 4096
+
+/**
+ * @brief 多线程版的_btree_print_render, 输出和单线程一字不差
+ *        ctx里的结构(address, depth, lchild, rchild)已经由层序遍历填好, 元素还没格式化, 由各线程调用label_fn格式化
+ *
+ *        1. 元素按块分给各线程格式化, 再拼进ctx->label_pool
+ *        2. 找到第一层结点数不少于8倍线程数的那一层, 这一层每个结点的子树是一个任务, 各线程算子树宽度;
+ *           上面那几层结点很少, 单线程倒着算完子树宽度再自顶向下算出横坐标, 然后各线程把横坐标推到各自的子树里
+ *           找不到这样的一层(比如退化成链)就直接单线程中序遍历
+ *        3. 每一行按BTREE_PRINT_PIECE_COLS列切成段, 凑满一轮分给各线程拼到一块大缓冲区里各自的位置,
+ *           再按顺序一次交给sink, 所以sink每次收到的是按顺序的一大块, 不再是正好一行
+ */
+static inline int _btree_print_render_parallel(BTreePrintCtx *ctx, _btree_print_label_fn label_fn, const char *elem_fmt, int nthreads,
+                                               btree_print_sink_fn sink, void *user, BTreePrintStats *stats)
+{
+    _BTreePrintPool pool;
+    int chunks, levels, d, i, l, r, x, base, row, col, piece_count, ret = -1;
+    int *width;
+    char *label_pool;
+    size_t total, round_cap, used;
+    unsigned long long t = 0;
+
+#ifdef BTREE_PRINT_NO_STATS
+    stats = NULL; /* 下面统计的分支都成了常量, 编译时整个删掉 */
+#endif
+    if (ctx->node_count == 0)
+        return 0;
+    if (_btree_print_pool_init(&pool, nthreads) < 0)
+        return -1;
+    pool.ctx = ctx;
+    pool.label_fn = label_fn;
+    pool.elem_fmt = elem_fmt;
+    levels = ctx->depth[ctx->node_count - 1];
+    chunks = (ctx->node_count + _BTREE_PRINT_LABEL_CHUNK - 1) / _BTREE_PRINT_LABEL_CHUNK;
+    pool.chunk_owner = (int *)malloc((size_t)chunks * sizeof(int));
+    pool.pool_base = (size_t *)malloc((size_t)pool.nthreads * sizeof(size_t));
+    pool.level_start = (int *)malloc((size_t)(levels + 1) * sizeof(int));
+    pool.row_end = (int *)malloc((size_t)(2 * levels) * sizeof(int));
+    pool.pieces = (_BTreePrintPiece *)malloc(_BTREE_PRINT_ROUND_PIECES * sizeof(_BTreePrintPiece));
+    if (pool.chunk_owner == NULL || pool.pool_base == NULL || pool.level_start == NULL || pool.row_end == NULL || pool.pieces == NULL)
+        goto out;
+    ctx->alloc_count += 5;
+
+    /* 1. 格式化元素 */
+    if (_btree_print_pool_run(&pool, _btree_print_par_label, chunks) < 0)
+        goto out;
+    for (total = 0, i = 0; i < pool.nthreads; ++i)
+    {
+        pool.pool_base[i] = total;
+        total += pool.workers[i].scratch.label_len;
+    }
+    if ((label_pool = (char *)_btree_print_grow(ctx, ctx->label_pool, &ctx->label_cap, total + 1, 1)) == NULL)
+        goto out;
+    ctx->label_pool = label_pool;
+    ctx->label_len = total;
+    if (_btree_print_pool_run(&pool, _btree_print_par_label_merge, chunks) < 0)
+        goto out;
+    if (stats != NULL)
+    {
+        t = _btree_print_now_ns();
+        stats->bfs_ns = t - stats->bfs_ns;
+    }
+
+    /* 2. 横坐标 */
+    for (d = 1, i = 0; d <= levels; ++d)
+    {
+        pool.level_start[d - 1] = i;
+        while (i < ctx->node_count && ctx->depth[i] == d)
+            ++i;
+    }
+    pool.level_start[levels] = ctx->node_count;
+    for (d = 0; d < levels && pool.level_start[d + 1] - pool.level_start[d] < 8 * pool.nthreads; ++d)
+        ;
+    if (ctx->layout == BTREE_PRINT_LAYOUT_TIDY)
+    { /* 紧凑排版单线程做, 它本身就是O(n)的线性扫描 */
+        if ((ctx->horizontal_accumu_cache = _btree_print_tidy(ctx)) < 0)
+            goto out;
+    }
+    else if (d == levels || pool.nthreads == 1)
+        ctx->horizontal_accumu_cache = _btree_print_inorder(ctx);
+    else
+    {
+        width = ctx->vert_index_arr;
+        pool.frontier = pool.level_start[d];
+        if (_btree_print_pool_run(&pool, _btree_print_par_width, pool.level_start[d + 1] - pool.frontier) < 0)
+            goto out;
+        for (i = pool.frontier - 1; i >= 0; --i)
+        {
+            l = ctx->lchild[i];
+            r = ctx->rchild[i];
+            width[i] = ctx->str_len[i] - 1 + (l != -1 ? width[l] : 0) + (r != -1 ? width[r] : 0);
+        }
+        ctx->left_margin[0] = 0;
+        for (i = 0; i < pool.frontier; ++i)
+        {
+            l = ctx->lchild[i];
+            r = ctx->rchild[i];
+            base = ctx->left_margin[i];
+            x = base + (l != -1 ? width[l] : 0);
+            ctx->left_margin[i] = x;
+            if (l != -1)
+                ctx->left_margin[l] = base;
+            if (r != -1)
+                ctx->left_margin[r] = x + ctx->str_len[i] - 1;
+        }
+        ctx->horizontal_accumu_cache = width[0];
+        if (_btree_print_pool_run(&pool, _btree_print_par_margin, pool.level_start[d + 1] - pool.frontier) < 0)
+            goto out;
+    }
+    if (stats != NULL)
+    {
+        stats->inorder_ns = _btree_print_now_ns() - t;
+        t = _btree_print_now_ns();
+    }
+
+    /* 3. 每一行的长度: 结点行到最后一个结点画到的地方, 竖线行到最后一根竖线 */
+    for (total = 0, d = 0; d < levels; ++d)
+    {
+        pool.row_end[2 * d] = _btree_print_extent_end(ctx, pool.level_start[d + 1] - 1);
+        pool.row_end[2 * d + 1] = 0;
+        for (i = pool.level_start[d + 1] - 1; d + 1 < levels && i >= pool.level_start[d]; --i)
+        {
+            if ((r = (ctx->rchild[i] != -1 ? ctx->rchild[i] : ctx->lchild[i])) != -1)
+            {
+                pool.row_end[2 * d + 1] = ctx->left_margin[r] + ctx->str_len[r] / 2 + 1;
+                break;
+            }
+        }
+        total += (size_t)pool.row_end[2 * d] + (size_t)pool.row_end[2 * d + 1] + 2;
+    }
+    /* 一轮的缓冲区够每个线程分到几段就行, 小树不用申请那么大 */
+    round_cap = (size_t)pool.nthreads * 4 * (BTREE_PRINT_PIECE_COLS + 1);
+    round_cap = round_cap < total ? round_cap : total;
+    if ((pool.round_buf = (char *)malloc(round_cap)) == NULL)
+        goto out;
+    ctx->alloc_count++;
+
+    /* 逐行切段, 凑满一轮就并行拼好, 按顺序输出 */
+    row = 0;
+    col = 0;
+    while (row < 2 * levels - 1)
+    {
+        piece_count = 0;
+        used = 0;
+        while (row < 2 * levels - 1 && piece_count < _BTREE_PRINT_ROUND_PIECES)
+        {
+            int col_end = pool.row_end[row] - col > BTREE_PRINT_PIECE_COLS ? col + BTREE_PRINT_PIECE_COLS : pool.row_end[row];
+            size_t bytes = (size_t)(col_end - col) + (col_end == pool.row_end[row]);
+            if (used + bytes > round_cap)
+                break;
+            pool.pieces[piece_count].row = row;
+            pool.pieces[piece_count].col_begin = col;
+            pool.pieces[piece_count].col_end = col_end;
+            pool.pieces[piece_count].out_off = used;
+            piece_count++;
+            used += bytes;
+            if (col_end == pool.row_end[row])
+            {
+                row++;
+                col = 0;
+            }
+            else
+                col = col_end;
+        }
+        if (_btree_print_pool_run(&pool, _btree_print_par_rows, piece_count) < 0)
+            goto out;
+        if (sink(user, pool.round_buf, used) != 0)
+            goto out;
+        if (stats != NULL)
+            stats->bytes_emitted += used;
+    }
+    if (stats != NULL)
+    {
+        stats->emit_ns = _btree_print_now_ns() - t;
+        stats->node_count = ctx->node_count;
+        stats->max_depth = levels;
+        stats->horizontal_accumu_cache = ctx->horizontal_accumu_cache;
+        stats->lines_emitted = (size_t)(2 * levels - 1);
+    }
+    ret = 0;
+out:
+    for (i = 0; i < pool.nthreads; ++i)
+        ctx->alloc_count += pool.workers[i].scratch.alloc_count;
+    if (stats != NULL)
+        stats->allocations = ctx->alloc_count - stats->allocations;
+    _btree_print_pool_free(&pool);
+    return ret;
+}
+
+/****************************************************************
+ * 异步打印: 调用者只做层序遍历, 把元素字符串和树的形状拷进一个ctx, 排版和输出交给后台线程
+ ****************************************************************/
+
+/* 队列满了的时候怎么办 */
+enum btree_print_async_policy
+{
+    BTREE_PRINT_ASYNC_DROP = 0, /* 直接丢掉这次打印, 调用者不会被卡住 */
+    BTREE_PRINT_ASYNC_BLOCK = 1 /* 等后台线程腾出位置 */
+};
+
+/**
+ * @brief 异步打印器, 一个后台线程加一个定长队列, 队列里每个位置是一个复用的ctx, 热起来以后调用者一侧不再申请内存
+ *        同一个打印器可以被多个线程同时使用, 输出按提交的顺序
+ * @example
+ *      BTreePrintAsync async;
+ *      btree_print_async_init(&async, 8, BTREE_PRINT_ASYNC_DROP);
+ *      btree_visual_print_async(&async, t, "%d", 0, btree_print_sink_file, stderr);
+ *      // t可以马上改, 也可以马上释放
+ *      btree_print_async_free(&async);
+ */
+typedef struct btree_print_async
+{
+    BTreePrintCtx *slot; /* 队列的各个位置, 层序遍历的结果放在这里 */
+    btree_print_sink_fn *sink;
+    void **user;
+    int *free_slot; /* 空闲位置的栈 */
+    int free_count;
+    int *ready; /* 等着输出的位置, 环形队列, 先进先出 */
+    int ready_head;
+    int ready_count;
+    int queue_len;
+    int policy;
+    int busy; /* 后台线程正在输出一个 */
+    int quit;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready_cond; /* 有东西要输出了, 或者要退出了 */
+    pthread_cond_t free_cond;  /* 腾出位置了, 或者全部输出完了 */
+    size_t submitted;          /* 以下都是统计, 用btree_print_async_stats读 */
+    size_t dropped;
+    size_t rendered;
+    size_t failed; /* 内存不足或者sink返回失败, 这一次的输出可能不完整 */
+    unsigned long long caller_ns_total;
+    unsigned long long caller_ns_max;
+} BTreePrintAsync;
+
+/* 异步打印的统计, 调用者一侧的耗时是从开始提交到入队(或放弃)为止, 包括等位置的时间 */
+typedef struct btree_print_async_stats
+{
+    size_t submitted;
+    size_t dropped;
+    size_t rendered;
+    size_t failed;
+    size_t pending; /* 还在队列里或者正在输出的 */
+    unsigned long long caller_ns_total;
+    unsigned long long caller_ns_max;
+} BTreePrintAsyncStats;
+
+/* 后台线程: 取出最早提交的一个, 排版输出, 再把位置还回去 */
+static inline void *_btree_print_async_main(void *arg)
+{
+    BTreePrintAsync *async = (BTreePrintAsync *)arg;
+    int s, ret;
+
+    pthread_mutex_lock(&async->mutex);
+    for (;;)
+    {
+        while (async->ready_count == 0 && !async->quit)
+            pthread_cond_wait(&async->ready_cond, &async->mutex);
+        if (async->ready_count == 0)
+            break;
+        s = async->ready[async->ready_head];
+        async->ready_head = (async->ready_head + 1) % async->queue_len;
+        async->ready_count--;
+        async->busy = 1;
+        pthread_mutex_unlock(&async->mutex);
+
+        ret = _btree_print_render(&async->slot[s], async->sink[s], async->user[s], NULL);
+
+        pthread_mutex_lock(&async->mutex);
+        async->busy = 0;
+        async->rendered++;
+        if (ret != 0)
+            async->failed++;
+        async->free_slot[async->free_count++] = s;
+        pthread_cond_broadcast(&async->free_cond);
+    }
+    pthread_mutex_unlock(&async->mutex);
+    return NULL;
+}
+
+/**
+ * @brief 初始化并启动后台线程
+ * @param queue_len 队列长度, 最多这么多次打印在排队, 每个位置各有一套缓冲区
+ * @param policy 队列满了的时候怎么办, 见enum btree_print_async_policy
+ * @return 0成功, -1内存不足或者线程启动失败
+ */
+static inline int btree_print_async_init(BTreePrintAsync *async, int queue_len, int policy)
+{
+    int i;
+
+    memset(async, 0, sizeof(*async));
+    if (queue_len < 1)
+        queue_len = 1;
+    async->slot = (BTreePrintCtx *)calloc((size_t)queue_len, sizeof(BTreePrintCtx));
+    async->sink = (btree_print_sink_fn *)calloc((size_t)queue_len, sizeof(btree_print_sink_fn));
+    async->user = (void **)calloc((size_t)queue_len, sizeof(void *));
+    async->free_slot = (int *)calloc((size_t)queue_len, sizeof(int));
+    async->ready = (int *)calloc((size_t)queue_len, sizeof(int));
+    if (async->slot == NULL || async->sink == NULL || async->user == NULL || async->free_slot == NULL || async->ready == NULL)
+        goto fail;
+    for (i = 0; i < queue_len; ++i)
+    {
+        btree_print_ctx_init(&async->slot[i]);
+        async->free_slot[i] = queue_len - 1 - i;
+    }
+    async->free_count = queue_len;
+    async->queue_len = queue_len;
+    async->policy = policy;
+    pthread_mutex_init(&async->mutex, NULL);
+    pthread_cond_init(&async->ready_cond, NULL);
+    pthread_cond_init(&async->free_cond, NULL);
+    if (pthread_create(&async->thread, NULL, _btree_print_async_main, async) != 0)
+    {
+        pthread_mutex_destroy(&async->mutex);
+        pthread_cond_destroy(&async->ready_cond);
+        pthread_cond_destroy(&async->free_cond);
+        goto fail;
+    }
+    return 0;
+fail:
+    free(async->slot);
+    free((void *)async->sink);
+    free(async->user);
+    free(async->free_slot);
+    free(async->ready);
+    memset(async, 0, sizeof(*async));
+    return -1;
+}
+
+/* 等到提交过的全部输出完, 比如sink的user要释放之前, 或者要和同步打印的输出排好先后 */
+static inline void btree_print_async_flush(BTreePrintAsync *async)
+{
+    pthread_mutex_lock(&async->mutex);
+    while (async->ready_count > 0 || async->busy)
+        pthread_cond_wait(&async->free_cond, &async->mutex);
+    pthread_mutex_unlock(&async->mutex);
+}
+
+/* 输出完队列里剩下的, 停掉后台线程, 释放全部缓冲区 */
+static inline void btree_print_async_free(BTreePrintAsync *async)
+{
+    int i;
+
+    if (async->slot == NULL)
+        return;
+    pthread_mutex_lock(&async->mutex);
+    async->quit = 1;
+    pthread_cond_signal(&async->ready_cond);
+    pthread_mutex_unlock(&async->mutex);
+    pthread_join(async->thread, NULL);
+    for (i = 0; i < async->queue_len; ++i)
+        btree_print_ctx_free(&async->slot[i]);
+    pthread_mutex_destroy(&async->mutex);
+    pthread_cond_destroy(&async->ready_cond);
+    pthread_cond_destroy(&async->free_cond);
+    free(async->slot);
+    free((void *)async->sink);
+    free(async->user);
+    free(async->free_slot);
+    free(async->ready);
+    memset(async, 0, sizeof(*async));
+}
+
+/* 读一份统计 */
+static inline void btree_print_async_stats(BTreePrintAsync *async, BTreePrintAsyncStats *stats)
+{
+    pthread_mutex_lock(&async->mutex);
+    stats->submitted = async->submitted;
+    stats->dropped = async->dropped;
+    stats->rendered = async->rendered;
+    stats->failed = async->failed;
+    stats->pending = (size_t)async->ready_count + (size_t)async->busy;
+    stats->caller_ns_total = async->caller_ns_total;
+    stats->caller_ns_max = async->caller_ns_max;
+    pthread_mutex_unlock(&async->mutex);
+}
+
+/* 记一次调用者一侧的耗时, 要在锁里调用 */
+static inline void _btree_print_async_caller_ns(BTreePrintAsync *async, unsigned long long t0)
+{
+    unsigned long long t = _btree_print_now_ns() - t0;
+    async->caller_ns_total += t;
+    if (t > async->caller_ns_max)
+        async->caller_ns_max = t;
+}
+
+/**
+ * 提交的第一步: 拿一个空闲位置, 层序遍历的结果就填到这个位置的ctx里
+ * @param t0 开始提交的时间, 丢弃时记进统计
+ * @return 位置下标, -1表示队列满了并且按BTREE_PRINT_ASYNC_DROP丢掉了这一次
+ */
+static inline int _btree_print_async_acquire(BTreePrintAsync *async, unsigned long long t0)
+{
+    int s = -1;
+    pthread_mutex_lock(&async->mutex);
+    while (async->free_count == 0 && async->policy == BTREE_PRINT_ASYNC_BLOCK)
+        pthread_cond_wait(&async->free_cond, &async->mutex);
+    if (async->free_count > 0)
+        s = async->free_slot[--async->free_count];
+    else
+    {
+        async->dropped++;
+        _btree_print_async_caller_ns(async, t0);
+    }
+    pthread_mutex_unlock(&async->mutex);
+    return s;
+}
+
+/* 提交的第二步: 填好了, 排进队列交给后台线程; ok为0表示填的时候内存不足, 位置直接还回去 */
+static inline void _btree_print_async_submit(BTreePrintAsync *async, int s, int ok, btree_print_sink_fn sink, void *user,
+                                             unsigned long long t0)
+{
+    pthread_mutex_lock(&async->mutex);
+    if (ok)
+    {
+        async->sink[s] = sink;
+        async->user[s] = user;
+        async->ready[(async->ready_head + async->ready_count) % async->queue_len] = s;
+        async->ready_count++;
+        async->submitted++;
+        pthread_cond_signal(&async->ready_cond);
+    }
+    else
+    {
+        async->failed++;
+        async->free_slot[async->free_count++] = s;
+        pthread_cond_broadcast(&async->free_cond);
+    }
+    _btree_print_async_caller_ns(async, t0);
+    pthread_mutex_unlock(&async->mutex);
+}
+
+#endif /* BTREE_PRINT_PTHREAD */
+
+#endif /* BTREE_VISUAL_PRINT_CORE_H */
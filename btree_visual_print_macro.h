@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "btree_visual_print_core.h"
+
 /* 需要类似下方的结构体，类似即可，不需要一模一样*/
 /*
 typedef struct node
@@ -22,7 +24,7 @@ typedef struct node
 } BTNode, *BTree;
 */
 /* data也可以是 int data, char *data, 等等 */
-/*但是如果用int *, char*, char**, struct A *, void* 这种再用指针另指元素, 下面函数有两行要修改, 已用TODO标出 */
+/*但是如果用int *, char*, char**, struct A *, void* 这种再用指针另指元素, 下面函数有一行要修改, 已用TODO标出 */
 
 /**
  * @brief
@@ -66,164 +68,319 @@ typedef struct node
 #define BTREE_VISUAL_PRINT(BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, FILE_IDENT)                    \
     do                                                                                                                               \
     {                                                                                                                                \
+        BTreePrintCtx _btree_print_local_ctx;                                                                                        \
+        btree_print_ctx_init(&_btree_print_local_ctx);                                                                               \
+        BTREE_VISUAL_PRINT_CTX(&_btree_print_local_ctx, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, FILE_IDENT); \
+        btree_print_ctx_free(&_btree_print_local_ctx);                                                                               \
+    } while (0)
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT, 但工作缓冲区由调用者提供, 反复打印时可以复用, 不用每次重新申请
+ * @param CTX_PTR 用btree_print_ctx_init初始化过的BTreePrintCtx的地址, 内存不足时什么都不打印
+ * @example
+ *      BTreePrintCtx ctx;
+ *      btree_print_ctx_init(&ctx);
+ *      BTREE_VISUAL_PRINT_CTX(&ctx, BTree, t1, lchild, rchild, data, "%d", stdout);
+ *      BTREE_VISUAL_PRINT_CTX(&ctx, BTree, t2, lchild, rchild, data, "%d", stdout);
+ *      btree_print_ctx_free(&ctx);
+ */
+#define BTREE_VISUAL_PRINT_CTX(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, FILE_IDENT)       \
+    BTREE_VISUAL_PRINT_SINK(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, btree_print_sink_file, (FILE_IDENT))
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT_CTX, 但不经过FILE*, 每拼好一行就交给SINK_FN, 可以写到内存, std::string, fd等等
+ * @param SINK_FN 输出函数, 见btree_print_sink_file, btree_print_sink_buf, btree_print_sink_fd, btree_print_sink_string
+ * @param SINK_USER 原样传给SINK_FN
+ * @example
+ *      BTreePrintCtx ctx;
+ *      BTreePrintBuf buf = {0};
+ *      btree_print_ctx_init(&ctx);
+ *      BTREE_VISUAL_PRINT_SINK(&ctx, BTree, t1, lchild, rchild, data, "%d", btree_print_sink_buf, &buf);
+ *      btree_print_ctx_free(&ctx);
+ *      free(buf.data);
+ */
+#define BTREE_VISUAL_PRINT_SINK(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, SINK_FN, SINK_USER) \
+    BTREE_VISUAL_PRINT_STATS(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, SINK_FN, SINK_USER, NULL)
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT_SINK, 另外把这次打印的统计信息写进STATS_PTR, 字段含义见BTreePrintStats
+ * @param STATS_PTR BTreePrintStats的地址, 传NULL就等于BTREE_VISUAL_PRINT_SINK
+ * @example
+ *      BTreePrintStats st;
+ *      BTREE_VISUAL_PRINT_STATS(&ctx, BTree, t1, lchild, rchild, data, "%d", btree_print_sink_file, stdout, &st);
+ */
+#define BTREE_VISUAL_PRINT_STATS(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, SINK_FN, SINK_USER, STATS_PTR) \
+    _BTREE_VISUAL_PRINT_IMPL(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, 0, SINK_FN, SINK_USER, STATS_PTR)
+
+/**
+ * @brief 摘要打印: 前MAX_DEPTH层完整打印, 再往下的每棵子树折叠成一个结点, 显示子树的结点个数, 比如(...+4213)
+ *        折叠的子树只数结点个数, 不格式化, 不排版, 不输出, 输出大小和排版时间只取决于前MAX_DEPTH层
+ * @param MAX_DEPTH 完整打印的层数, 根是第1层; 小于等于0时不折叠, 等于BTREE_VISUAL_PRINT_SINK
+ * @example
+ *      BTREE_VISUAL_PRINT_SUMMARY(&ctx, BTree, t1, lchild, rchild, data, "%d", 2, btree_print_sink_file, stdout);
+ *
+ *           _________(85)_________
+ *           |                     |
+ *     ____(67)___           ____(119)____
+ *     |          |          |            |
+ * (...+155)  (...+842)  (...+797)   (...+2298)
+ */
+#define BTREE_VISUAL_PRINT_SUMMARY(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER) \
+    _BTREE_VISUAL_PRINT_IMPL(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER, NULL)
+
+/* 上面几个宏最终都展开成这个 */
+#define _BTREE_VISUAL_PRINT_IMPL(CTX_PTR, BTREE_TYPE, ROOT_IDENT, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER, STATS_PTR) \
+    do                                                                                                                               \
+    {                                                                                                                                \
+        BTreePrintCtx *_ctx = (CTX_PTR);                                                                                             \
+        BTreePrintStats *_stats = (STATS_PTR);                                                                                       \
+        int _max_depth = (MAX_DEPTH);                                                                                                \
+        if (_stats != NULL)                                                                                                          \
+            _btree_print_stats_begin(_ctx, _stats);                                                                                  \
         if (ROOT_IDENT == NULL)                                                                                                      \
             break;                                                                                                                   \
-        const int _MAX_STR_LEN = 128;        /* 单个元素打印成str最大长度 */                                              \
-        const int _MAX_NODE_NUM = 1024;      /* 结点最大个数 */                                                                \
-        const char horiz_conj_char = '_';    /* 连接横线 */                                                                      \
-        const char vert_conj_char = '|';     /* 竖线 */                                                                            \
-        const char left_bracket_char = '(';  /* 每个元素左边的小括号, 你也可以换成你喜欢的 */                    \
-        const char right_bracket_char = ')'; /* 元素右边的小括号 */                                                          \
-                                                                                                                                     \
-        /* 思路: 层序遍历算深度, 中序遍历算横坐标, 用结构体数组把这些信息存好再统一打印 */        \
-        typedef struct _node_print_info                                                                                              \
-        {                                                                                                                            \
-            BTREE_TYPE address; /* 二次遍历时的唯一区分标志，即key //用hash表将地址映射会更省时间空间 */ \
-            int str_len;                                                                                                             \
-            int depth;                                                                                                               \
-            int left_margin; /*  horizontal coordintate */                                                                           \
-        } _Info;                                                                                                                     \
                                                                                                                                      \
-        BTREE_TYPE tree_deque[_MAX_NODE_NUM];                                                                                        \
-        int depth_queue[_MAX_NODE_NUM]; /* 记录深度的队列 */                                                                  \
-        _Info *info_p_arr[_MAX_NODE_NUM];                                                                                            \
-        int node_count = 0;                                                                                                          \
-        int front = -1, rear = -1;                                                                                                   \
+        /* 思路: 层序遍历算深度, 中序遍历算横坐标, 把这些信息存进ctx的结点信息表再统一打印 */     \
+        /* 所有数组都在ctx里按需增长, 结点个数和元素长度都没有上限 */                                       \
+        int front, child, alloc_failed = 0;                                                                                          \
         BTREE_TYPE p;                                                                                                                \
-        _Info *info_p;                                                                                                               \
-        char temp_str[_MAX_STR_LEN];                                                                                                 \
+        _btree_print_reset(_ctx);                                                                                                    \
                                                                                                                                      \
-        /* 用队列统计结点的深度信息, 顺便统计每个结点数据打印时的长度 */                                 \
-        tree_deque[++rear] = ROOT_IDENT;                                                                                             \
-        depth_queue[rear] = 1;                                                                                                       \
-        while (front < rear)                                                                                                         \
+        /* 用队列统计结点的深度信息, 顺便把每个结点的数据格式化进_ctx->label_pool, 打印时直接拷贝, 不再格式化第二次 */ \
+        /* ctx->address本身就是队列, 结点的下标就是它的层序序号, 孩子入队时顺手记下孩子的下标 */    \
+        if (_btree_print_push_info(_ctx, ROOT_IDENT, 1) < 0)                                                                         \
+            break;                                                                                                                   \
+        for (front = 0; front < _ctx->node_count; ++front)                                                                           \
         {                                                                                                                            \
-            p = tree_deque[++front];                                                                                                 \
-            info_p = (_Info *)calloc(1, sizeof(_Info));                                                                              \
-            info_p->address = p; /* 记录地址 */                                                                                  \
-            memset(temp_str, 0, _MAX_STR_LEN);                                                                                       \
-            sprintf(temp_str, ELEM_FMT_STR, p->DATA_IDENT); /*  TODO: 注意 */                                                      \
-            info_p->str_len = strlen(temp_str) + 2;         /* 计算打印后的元素长度 */                                     \
-            info_p->depth = depth_queue[front];                                                                                      \
-            info_p_arr[node_count++] = info_p;                                                                                       \
+            p = (BTREE_TYPE)_ctx->address[front];                                                                                    \
+            if (_max_depth > 0 && _ctx->depth[front] > _max_depth)                                                                   \
+            { /* 折叠结点只数个数, 不格式化, 孩子也不入队; 用_ctx->walk_stack当栈, 不递归 */                 \
+                int walk_top = 0, walk_count = 0;                                                                                    \
+                BTREE_TYPE q;                                                                                                        \
+                if (_btree_print_reserve_walk(_ctx, 1) < 0)                                                                          \
+                {                                                                                                                    \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
+                }                                                                                                                    \
+                _ctx->walk_stack[walk_top++] = p;                                                                                    \
+                while (walk_top > 0)                                                                                                 \
+                {                                                                                                                    \
+                    q = (BTREE_TYPE)_ctx->walk_stack[--walk_top];                                                                    \
+                    walk_count++;                                                                                                    \
+                    if (_btree_print_reserve_walk(_ctx, (size_t)walk_top + 2) < 0)                                                   \
+                    {                                                                                                                \
+                        alloc_failed = 1;                                                                                            \
+                        break;                                                                                                       \
+                    }                                                                                                                \
+                    if (q->LEFT_IDENT != NULL)                                                                                       \
+                        _ctx->walk_stack[walk_top++] = q->LEFT_IDENT;                                                                \
+                    if (q->RIGHT_IDENT != NULL)                                                                                      \
+                        _ctx->walk_stack[walk_top++] = q->RIGHT_IDENT;                                                               \
+                }                                                                                                                    \
+                if (alloc_failed || _btree_print_put_collapsed(_ctx, front, walk_count) < 0)                                         \
+                {                                                                                                                    \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
+                }                                                                                                                    \
+                continue;                                                                                                            \
+            }                                                                                                                        \
+            if (_btree_print_put_label(_ctx, front, ELEM_FMT_STR, p->DATA_IDENT) < 0) /* TODO: 注意 */                             \
+            {                                                                                                                        \
+                alloc_failed = 1;                                                                                                    \
+                break;                                                                                                               \
+            }                                                                                                                        \
                                                                                                                                      \
             if (p->LEFT_IDENT != NULL)                                                                                               \
             {                                                                                                                        \
-                tree_deque[++rear] = p->LEFT_IDENT;                                                                                  \
-                depth_queue[rear] = depth_queue[front] + 1;                                                                          \
+                if ((child = _btree_print_push_info(_ctx, p->LEFT_IDENT, _ctx->depth[front] + 1)) < 0)                               \
+                {                                                                                                                    \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
+                }                                                                                                                    \
+                _ctx->lchild[front] = child;                                                                                         \
             }                                                                                                                        \
             if (p->RIGHT_IDENT != NULL)                                                                                              \
             {                                                                                                                        \
-                tree_deque[++rear] = p->RIGHT_IDENT;                                                                                 \
-                depth_queue[rear] = depth_queue[front] + 1;                                                                          \
+                if ((child = _btree_print_push_info(_ctx, p->RIGHT_IDENT, _ctx->depth[front] + 1)) < 0)                              \
+                {                                                                                                                    \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
+                }                                                                                                                    \
+                _ctx->rchild[front] = child;                                                                                         \
             }                                                                                                                        \
         }                                                                                                                            \
                                                                                                                                      \
-        /* 接下来统计横坐标, 用中序遍历 */                                                                              \
-        p = ROOT_IDENT;                                                                                                              \
-        int top = -1, i;                                                                                                             \
-        int horizontal_accumu_cache = 0; /* 横坐标累计长度 */                                                                 \
-        do                                                                                                                           \
+        /* 接下来中序遍历统计横坐标, 然后逐行打印, 这部分和结点类型无关, 见btree_visual_print_core.h */ \
+        if (!alloc_failed)                                                                                                           \
+            _btree_print_render(_ctx, (SINK_FN), (SINK_USER), _stats);                                                               \
+    } while (0)
+
+/**
+ * @brief 打印存在数组里的二叉堆(下标i的孩子是2i+1和2i+2), 不用先拷成指针树
+ *        层序序号就是数组下标, 只按下标顺序扫一遍数组, 没有指针, 也不用队列
+ * @param ARRAY_IDENT 数组名或指向首元素的指针
+ * @param COUNT 元素个数
+ * @param DATA_SUFFIX 接在ARRAY_IDENT[i]后面取出要打印的数据, 比如.key, 元素本身就是数据时留空
+ * @example
+ *      int heap[] = {1, 3, 2, 7, 4};
+ *      BTREE_VISUAL_PRINT_HEAP(&ctx, heap, 5, , "%d", btree_print_sink_file, stdout);
+ *
+ *      struct task { int prio; void *arg; } tasks[64];
+ *      BTREE_VISUAL_PRINT_HEAP(&ctx, tasks, task_count, .prio, "%d", btree_print_sink_file, stdout);
+ *
+ *    ___(1)
+ *    |     |
+ *  _(3)   (2)
+ *  |   |
+ * (7) (4)
+ */
+#define BTREE_VISUAL_PRINT_HEAP(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, SINK_FN, SINK_USER)                          \
+    _BTREE_VISUAL_PRINT_HEAP_IMPL(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, 0, SINK_FN, SINK_USER, NULL)
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT_HEAP, 另外把这次打印的统计信息写进STATS_PTR, 同BTREE_VISUAL_PRINT_STATS
+ */
+#define BTREE_VISUAL_PRINT_HEAP_STATS(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, SINK_FN, SINK_USER, STATS_PTR)         \
+    _BTREE_VISUAL_PRINT_HEAP_IMPL(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, 0, SINK_FN, SINK_USER, STATS_PTR)
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT_HEAP, 但只完整打印前MAX_DEPTH层, 同BTREE_VISUAL_PRINT_SUMMARY
+ *        只扫数组开头的2^(MAX_DEPTH+1)-1个元素, 折叠的子树大小按下标直接算出来, 不用数
+ */
+#define BTREE_VISUAL_PRINT_HEAP_SUMMARY(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER)       \
+    _BTREE_VISUAL_PRINT_HEAP_IMPL(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER, NULL)
+
+/* 上面几个堆的宏最终都展开成这个 */
+#define _BTREE_VISUAL_PRINT_HEAP_IMPL(CTX_PTR, ARRAY_IDENT, COUNT, DATA_SUFFIX, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER, STATS_PTR) \
+    do                                                                                                                               \
+    {                                                                                                                                \
+        BTreePrintCtx *_ctx = (CTX_PTR);                                                                                             \
+        BTreePrintStats *_stats = (STATS_PTR);                                                                                       \
+        int _count = (COUNT), _max_depth = (MAX_DEPTH), _kept, _i;                                                                   \
+        if (_stats != NULL)                                                                                                          \
+            _btree_print_stats_begin(_ctx, _stats);                                                                                  \
+        if ((_kept = _btree_print_fill_heap(_ctx, _count, _max_depth)) < 0)                                                          \
+            break;                                                                                                                   \
+        for (_i = 0; _i < _kept; ++_i)                                                                                               \
         {                                                                                                                            \
-            while (p != NULL)                                                                                                        \
-            {                                                                                                                        \
-                tree_deque[++top] = p;                                                                                               \
-                p = p->LEFT_IDENT;                                                                                                   \
-            }                                                                                                                        \
-            p = tree_deque[top--];                                                                                                   \
-            for (i = 0; i < node_count; ++i)                                                                                         \
-            { /* 这里用hash表的优势就体现出来了 */                                                                      \
-                if (info_p_arr[i]->address == p)                                                                                     \
-                { /* 计算横坐标 */                                                                                              \
-                    info_p_arr[i]->left_margin = horizontal_accumu_cache;                                                            \
-                    horizontal_accumu_cache += info_p_arr[i]->str_len - 1; /* 减一可以重叠一个括号,更紧凑一点点 */   \
-                }                                                                                                                    \
+            if (_max_depth > 0 && _ctx->depth[_i] > _max_depth)                                                                      \
+            { /* 折叠结点不格式化, 子树大小按下标算 */                                                               \
+                if (_btree_print_put_collapsed(_ctx, _i, _btree_print_heap_subtree(_i, _count)) < 0)                                 \
+                    break;                                                                                                           \
             }                                                                                                                        \
-            p = p->RIGHT_IDENT;                                                                                                      \
-        } while (!(p == NULL && top == -1));                                                                                         \
+            else if (_btree_print_put_label(_ctx, _i, ELEM_FMT_STR, (ARRAY_IDENT)[_i] DATA_SUFFIX) < 0) /* TODO: 注意 */           \
+                break;                                                                                                               \
+        }                                                                                                                            \
+        if (_i == _kept)                                                                                                             \
+            _btree_print_render(_ctx, (SINK_FN), (SINK_USER), _stats);                                                               \
+    } while (0)
+
+/**
+ * @brief 打印结点池里的二叉树: 结点都在一个数组里, 孩子是int下标而不是指针, 小于0表示没有
+ *        层序遍历的队列里放的就是下标本身, 按下标访问结点, 不需要先拷成指针树, 也不用取地址再换回下标
+ * @param POOL_IDENT 结点数组名, 指向首元素的指针, 或者任何能写POOL_IDENT[i]的表达式
+ * @param ROOT_INDEX 根结点的下标, 小于0表示空树
+ * @param LEFT_IDENT 结点中左孩子下标的成员名, 比如left
+ * @param RIGHT_IDENT 结点中右孩子下标的成员名, 比如right
+ * @param DATA_IDENT 结点中数据域的成员名, 比如key
+ * @example
+ *      struct slot { int key; int32_t left, right; } pool[1024];
+ *      BTREE_VISUAL_PRINT_POOL(&ctx, pool, root, left, right, key, "%d", btree_print_sink_file, stdout);
+ */
+#define BTREE_VISUAL_PRINT_POOL(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, SINK_FN, SINK_USER) \
+    _BTREE_VISUAL_PRINT_POOL_IMPL(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, 0, SINK_FN, SINK_USER, NULL)
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT_POOL, 另外把这次打印的统计信息写进STATS_PTR, 同BTREE_VISUAL_PRINT_STATS
+ */
+#define BTREE_VISUAL_PRINT_POOL_STATS(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, SINK_FN, SINK_USER, STATS_PTR) \
+    _BTREE_VISUAL_PRINT_POOL_IMPL(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, 0, SINK_FN, SINK_USER, STATS_PTR)
+
+/**
+ * @brief 同BTREE_VISUAL_PRINT_POOL, 但只完整打印前MAX_DEPTH层, 同BTREE_VISUAL_PRINT_SUMMARY
+ */
+#define BTREE_VISUAL_PRINT_POOL_SUMMARY(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER) \
+    _BTREE_VISUAL_PRINT_POOL_IMPL(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER, NULL)
+
+/* 上面几个结点池的宏最终都展开成这个; 下标转成uintptr_t存进ctx->address和walk_stack, 取出来再转回long */
+#define _BTREE_VISUAL_PRINT_POOL_IMPL(CTX_PTR, POOL_IDENT, ROOT_INDEX, LEFT_IDENT, RIGHT_IDENT, DATA_IDENT, ELEM_FMT_STR, MAX_DEPTH, SINK_FN, SINK_USER, STATS_PTR) \
+    do                                                                                                                               \
+    {                                                                                                                                \
+        BTreePrintCtx *_ctx = (CTX_PTR);                                                                                             \
+        BTreePrintStats *_stats = (STATS_PTR);                                                                                       \
+        long _root = (long)(ROOT_INDEX), _index, _child;                                                                             \
+        int _max_depth = (MAX_DEPTH), front, child, alloc_failed = 0;                                                                \
+        if (_stats != NULL)                                                                                                          \
+            _btree_print_stats_begin(_ctx, _stats);                                                                                  \
+        _btree_print_reset(_ctx);                                                                                                    \
+        if (_root < 0)                                                                                                               \
+            break;                                                                                                                   \
                                                                                                                                      \
-        /* 接下来开始打印 */                                                                                                  \
-        int horiz_left_start, horiz_right_end, cursor, j, k, cur_depth = 1, end_flag = 0;                                            \
-        int vert_index_arr[_MAX_NODE_NUM]; /* 偶数行的竖线存储数组 */                                                      \
-        i = 0;                                                                                                                       \
-        while (i < node_count)                                                                                                       \
+        /* 同BTREE_VISUAL_PRINT, ctx->address是队列, 只是放的不是地址而是结点在池里的下标 */                   \
+        if (_btree_print_push_info(_ctx, (const void *)(uintptr_t)_root, 1) < 0)                                                     \
+            break;                                                                                                                   \
+        for (front = 0; front < _ctx->node_count; ++front)                                                                           \
         {                                                                                                                            \
-            k = -1;                                                                                                                  \
-            cursor = 0;                                                                                                              \
-            while (info_p_arr[i]->depth == cur_depth)                                                                                \
-            {                                                                                                                        \
-                /* 打印左边 */                                                                                                   \
-                p = info_p_arr[i]->address;                                                                                          \
-                if (p->LEFT_IDENT != NULL)                                                                                           \
-                { /* 有左孩子说明有横线要打印 */                                                                         \
-                    for (j = 0; j < node_count; ++j)                                                                                 \
-                    { /* 暴力查找 */                                                                                             \
-                        if (info_p_arr[j]->address == p->LEFT_IDENT)                                                                 \
-                        {                                                                                                            \
-                            horiz_left_start = info_p_arr[j]->left_margin + info_p_arr[j]->str_len / 2;                              \
-                            vert_index_arr[++k] = horiz_left_start;                                                                  \
-                            break;                                                                                                   \
-                        }                                                                                                            \
-                    }                                                                                                                \
-                    for (; cursor < horiz_left_start; ++cursor)                                                                      \
-                        fprintf(FILE_IDENT, " ");                                                                                    \
-                    for (; cursor < info_p_arr[i]->left_margin; ++cursor)                                                            \
-                        fprintf(FILE_IDENT, "%c", horiz_conj_char);                                                                  \
-                }                                                                                                                    \
-                else                                                                                                                 \
-                { /* 没有左孩子全打印空格即可 */                                                                         \
-                    for (; cursor < info_p_arr[i]->left_margin; ++cursor)                                                            \
-                        fprintf(FILE_IDENT, " ");                                                                                    \
+            _index = (long)(uintptr_t)_ctx->address[front];                                                                          \
+            if (_max_depth > 0 && _ctx->depth[front] > _max_depth)                                                                   \
+            { /* 折叠结点只数个数, 不格式化, 孩子也不入队; 用_ctx->walk_stack当栈, 同样放下标 */           \
+                int walk_top = 0, walk_count = 0;                                                                                    \
+                long q;                                                                                                              \
+                if (_btree_print_reserve_walk(_ctx, 1) < 0)                                                                          \
+                {                                                                                                                    \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
                 }                                                                                                                    \
-                                                                                                                                     \
-                /* 打印元素 */                                                                                                   \
-                fprintf(FILE_IDENT, "%c", left_bracket_char);                                                                        \
-                fprintf(FILE_IDENT, ELEM_FMT_STR, p->DATA_IDENT); /* 这里要注意TODO: */                                         \
-                fprintf(FILE_IDENT, "%c", right_bracket_char);                                                                       \
-                cursor += info_p_arr[i]->str_len;                                                                                    \
-                                                                                                                                     \
-                /* 打印右边 */                                                                                                   \
-                if (p->RIGHT_IDENT != NULL)                                                                                          \
+                _ctx->walk_stack[walk_top++] = (const void *)(uintptr_t)_index;                                                      \
+                while (walk_top > 0)                                                                                                 \
                 {                                                                                                                    \
-                    for (j = 0; j < node_count; ++j)                                                                                 \
+                    q = (long)(uintptr_t)_ctx->walk_stack[--walk_top];                                                               \
+                    walk_count++;                                                                                                    \
+                    if (_btree_print_reserve_walk(_ctx, (size_t)walk_top + 2) < 0)                                                   \
                     {                                                                                                                \
-                        if (info_p_arr[j]->address == p->RIGHT_IDENT)                                                                \
-                        {                                                                                                            \
-                            horiz_right_end = info_p_arr[j]->left_margin + info_p_arr[j]->str_len / 2;                               \
-                            vert_index_arr[++k] = horiz_right_end;                                                                   \
-                            break;                                                                                                   \
-                        }                                                                                                            \
+                        alloc_failed = 1;                                                                                            \
+                        break;                                                                                                       \
                     }                                                                                                                \
-                    for (; cursor < horiz_right_end; ++cursor)                                                                       \
-                        fprintf(FILE_IDENT, "%c", horiz_conj_char);                                                                  \
-                } /* 右边没有else ,因为只考虑横线即可, 空白算到同层下一个元素左边 */                       \
-                                                                                                                                     \
-                if (++i >= node_count)                                                                                               \
+                    if ((_child = (long)(POOL_IDENT)[q].LEFT_IDENT) >= 0)                                                            \
+                        _ctx->walk_stack[walk_top++] = (const void *)(uintptr_t)_child;                                              \
+                    if ((_child = (long)(POOL_IDENT)[q].RIGHT_IDENT) >= 0)                                                           \
+                        _ctx->walk_stack[walk_top++] = (const void *)(uintptr_t)_child;                                              \
+                }                                                                                                                    \
+                if (alloc_failed || _btree_print_put_collapsed(_ctx, front, walk_count) < 0)                                         \
                 {                                                                                                                    \
-                    end_flag = 1; /* 打印完最后一个元素, 下一行不需要竖线了,提前结束 */                        \
+                    alloc_failed = 1;                                                                                                \
                     break;                                                                                                           \
                 }                                                                                                                    \
+                continue;                                                                                                            \
             }                                                                                                                        \
-            fprintf(FILE_IDENT, "\n");                                                                                               \
-                                                                                                                                     \
-            /* 打印竖线 */                                                                                                       \
-            if (!end_flag)                                                                                                           \
+            if (_btree_print_put_label(_ctx, front, ELEM_FMT_STR, (POOL_IDENT)[_index].DATA_IDENT) < 0) /* TODO: 注意 */           \
+            {                                                                                                                        \
+                alloc_failed = 1;                                                                                                    \
+                break;                                                                                                               \
+            }                                                                                                                        \
+            if ((_child = (long)(POOL_IDENT)[_index].LEFT_IDENT) >= 0)                                                               \
+            {                                                                                                                        \
+                if ((child = _btree_print_push_info(_ctx, (const void *)(uintptr_t)_child, _ctx->depth[front] + 1)) < 0)             \
+                {                                                                                                                    \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
+                }                                                                                                                    \
+                _ctx->lchild[front] = child;                                                                                         \
+            }                                                                                                                        \
+            if ((_child = (long)(POOL_IDENT)[_index].RIGHT_IDENT) >= 0)                                                              \
             {                                                                                                                        \
-                cursor = 0;                                                                                                          \
-                for (j = 0; j <= k; ++j)                                                                                             \
+                if ((child = _btree_print_push_info(_ctx, (const void *)(uintptr_t)_child, _ctx->depth[front] + 1)) < 0)             \
                 {                                                                                                                    \
-                    for (; cursor < vert_index_arr[j]; ++cursor)                                                                     \
-                        fprintf(FILE_IDENT, " ");                                                                                    \
-                    fprintf(FILE_IDENT, "%c", vert_conj_char);                                                                       \
-                    cursor++;                                                                                                        \
+                    alloc_failed = 1;                                                                                                \
+                    break;                                                                                                           \
                 }                                                                                                                    \
-                fprintf(FILE_IDENT, "\n");                                                                                           \
+                _ctx->rchild[front] = child;                                                                                         \
             }                                                                                                                        \
-            cur_depth++;                                                                                                             \
         }                                                                                                                            \
-        for (i = 0; i < node_count; ++i)                                                                                             \
-            free(info_p_arr[i]); /* 释放空间 */                                                                                  \
+        if (!alloc_failed)                                                                                                           \
+            _btree_print_render(_ctx, (SINK_FN), (SINK_USER), _stats);                                                               \
     } while (0)
+
 /****************************************************************
 为了打印水平线很多想法：
 暴力法, 暴力查找
@@ -233,4 +390,10 @@ typedef struct node
 但是, 如果把多看一行和记录虚索引结合起来可以吗?需要向后搜索, 效率有所提高, 但是不会太高
 如果用二维数组虚索引+记录下标呢, 然后根据二维数组地址连续性, 用偏移量得到反查结果,不行, 但是用静态链表法可以, 但是花销会很大
 最终妥协了, 暴力吧.反正是辅助函数
+
+后来发现其实不用反查: 层序遍历时结点出队的顺序就是它在info_arr中的下标,
+孩子入队时的rear就是孩子的下标, 入队时顺手记下来即可, 中序遍历的栈也直接放下标, 整个过程O(n)
+再后来所有数组都挪到了堆上(BTreePrintCtx), 按需两倍增长, 结点个数不再有1024的上限
+结点信息表也从每个结点calloc一个结构体改成了一块arena里的平行数组, 新ctx按两倍扩容只申请O(log n)次, 复用ctx时一次都不用申请
+摘要打印时超过MAX_DEPTH的子树不进队列, 只数个数, 折叠成一个结点
 ****************************************************************/